@@ -0,0 +1,473 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+// Benchmark of GP hot paths (framing, serialization and compression)
+//
+// Every scenario is executed over pure in-memory path (frames are produced by frameFromPacket and
+// fed directly to processIncoming), over a loopback TCP connection and over a local socket, results are printed to
+// stdout as one JSON object per line, so that they can be compared between builds
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QMutex>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include <atomic>
+#include <algorithm>
+#include "../capture.h"
+#include "../gp.h"
+
+using namespace libgp;
+
+// Used to compute latency of packets, shared by both sides of connection since they live in same process
+static QElapsedTimer bench_clock;
+
+class BenchGP : public GP
+{
+    public:
+        BenchGP(QTcpSocket *tcp_socket = nullptr, bool mt = false) : GP(tcp_socket, mt)
+        {
+            this->MaxIncomingCacheSize = 128 * 1024 * 1024;
+            this->received = 0;
+        }
+        QByteArray Frame(const QHash<QString, QVariant> &packet)
+        {
+            return this->frameFromPacket(packet);
+        }
+        void Feed(const QByteArray &data)
+        {
+            this->processIncoming(data);
+        }
+        void ResetLatencies()
+        {
+            this->latencyLock.lock();
+            this->latencies.clear();
+            this->latencyLock.unlock();
+            this->received = 0;
+        }
+        QVector<qint64> GetLatencies()
+        {
+            QMutexLocker locker(&this->latencyLock);
+            return this->latencies;
+        }
+        std::atomic<unsigned long long> received;
+
+    protected:
+        void dispatchPacket(const QHash<QString, QVariant> &pack) override
+        {
+            if (pack.contains("t"))
+            {
+                qint64 latency = bench_clock.nsecsElapsed() - pack["t"].toLongLong();
+                this->latencyLock.lock();
+                this->latencies.append(latency);
+                this->latencyLock.unlock();
+            }
+            GP::dispatchPacket(pack);
+            this->received++;
+        }
+
+    private:
+        QMutex latencyLock;
+        QVector<qint64> latencies;
+};
+
+static QHash<QString, QVariant> tinyPacket(int n)
+{
+    // Single IRC line as it's delivered from grumpyd to grumpy
+    QHash<QString, QVariant> parameters;
+    parameters.insert("network_id", QVariant(1));
+    parameters.insert("channel", QVariant(QString("#grumpy")));
+    parameters.insert("source", QVariant(QString("petan!petan@wikimedia/Petrb")));
+    parameters.insert("text", QVariant(QString("hello world, this is line number ") + QString::number(n)));
+    QHash<QString, QVariant> pack;
+    pack.insert("type", QVariant(GP_TYPE_SYSTEM));
+    pack.insert("cid", QVariant(100));
+    pack.insert("parameters", QVariant(parameters));
+    return pack;
+}
+
+static QHash<QString, QVariant> mediumPacket(int n)
+{
+    // Channel state update with a user list
+    QHash<QString, QVariant> users;
+    for (int i = 0; i < 200; i++)
+    {
+        QHash<QString, QVariant> user;
+        user.insert("nick", QVariant(QString("user") + QString::number(i)));
+        user.insert("ident", QVariant(QString("~ident") + QString::number(i)));
+        user.insert("host", QVariant(QString("host-") + QString::number(i) + ".example.org"));
+        user.insert("modes", QVariant(QString(i % 10 == 0 ? "o" : "")));
+        users.insert(QString::number(i), QVariant(user));
+    }
+    QHash<QString, QVariant> parameters;
+    parameters.insert("network_id", QVariant(1));
+    parameters.insert("channel", QVariant(QString("#grumpy")));
+    parameters.insert("topic", QVariant(QString("Topic of channel, revision ") + QString::number(n)));
+    parameters.insert("users", QVariant(users));
+    QHash<QString, QVariant> pack;
+    pack.insert("type", QVariant(GP_TYPE_SYSTEM));
+    pack.insert("cid", QVariant(101));
+    pack.insert("parameters", QVariant(parameters));
+    return pack;
+}
+
+static QHash<QString, QVariant> largePacket(int n)
+{
+    // Scrollback resync, this is a few megabytes of data
+    QList<QVariant> lines;
+    for (int i = 0; i < 20000; i++)
+    {
+        QHash<QString, QVariant> line;
+        line.insert("id", QVariant(n * 20000 + i));
+        line.insert("time", QVariant(QDateTime::fromTime_t(1500000000 + i)));
+        line.insert("source", QVariant(QString("user") + QString::number(i % 50)));
+        line.insert("text", QVariant(QString("Some longer line of text that was said on channel a long time ago ") + QString::number(i)));
+        lines.append(QVariant(line));
+    }
+    QHash<QString, QVariant> parameters;
+    parameters.insert("network_id", QVariant(1));
+    parameters.insert("channel", QVariant(QString("#grumpy")));
+    parameters.insert("scrollback", QVariant(lines));
+    QHash<QString, QVariant> pack;
+    pack.insert("type", QVariant(GP_TYPE_SYSTEM));
+    pack.insert("cid", QVariant(102));
+    pack.insert("parameters", QVariant(parameters));
+    return pack;
+}
+
+static QList<QHash<QString, QVariant> > makeMix(const QString &mix, bool quick)
+{
+    QList<QHash<QString, QVariant> > packets;
+    int scale = quick ? 10 : 1;
+    if (mix == "tiny")
+    {
+        for (int i = 0; i < 100000 / scale; i++)
+            packets.append(tinyPacket(i));
+    } else if (mix == "medium")
+    {
+        for (int i = 0; i < 2000 / scale; i++)
+            packets.append(mediumPacket(i));
+    } else if (mix == "large")
+    {
+        for (int i = 0; i < 20 / scale; i++)
+            packets.append(largePacket(i));
+    } else if (mix == "mixed")
+    {
+        // Roughly what a busy session looks like, mostly lines, some state updates and occasional resync
+        for (int i = 0; i < 20000 / scale; i++)
+        {
+            if (i % 1000 == 999)
+                packets.append(largePacket(i));
+            else if (i % 50 == 49)
+                packets.append(mediumPacket(i));
+            else
+                packets.append(tinyPacket(i));
+        }
+    }
+    return packets;
+}
+
+class Result
+{
+    public:
+        QString Path;
+        QString Mix;
+        int Compression;
+        bool MT;
+        unsigned long long Packets;
+        unsigned long long WireBytes;
+        qint64 SendNs;
+        qint64 TotalNs;
+        //! Receiver didn't get all packets in time, numbers of such run are not valid
+        bool TimedOut;
+        QVector<qint64> Latencies;
+        StatisticsSnapshot Sender;
+        StatisticsSnapshot Receiver;
+};
+
+static qint64 percentile(QVector<qint64> values, double p)
+{
+    if (values.isEmpty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    int index = static_cast<int>(p * (values.size() - 1));
+    return values.at(index);
+}
+
+// Returns false if the result is not valid
+static bool printResult(QTextStream &out, const Result &r)
+{
+    double seconds = static_cast<double>(r.TotalNs) / 1000000000.0;
+    if (seconds <= 0)
+        seconds = 0.000000001;
+    out << "{\"path\":\"" << r.Path << "\""
+        << ",\"mix\":\"" << r.Mix << "\""
+        << ",\"compression\":";
+    if (r.Compression < 0)
+        out << "null";
+    else
+        out << r.Compression;
+    out << ",\"mt\":" << (r.MT ? "true" : "false")
+        << ",\"timeout\":" << (r.TimedOut ? "true" : "false")
+        << ",\"packets\":" << r.Packets
+        << ",\"wire_bytes\":" << r.WireBytes
+        << ",\"seconds\":" << seconds
+        << ",\"packets_per_sec\":" << (static_cast<double>(r.Packets) / seconds)
+        << ",\"mb_per_sec\":" << (static_cast<double>(r.WireBytes) / seconds / (1024 * 1024))
+        << ",\"send_ns_per_packet\":" << (r.Packets ? r.SendNs / static_cast<qint64>(r.Packets) : 0)
+        << ",\"serialize_ns\":" << r.Sender.StageTime[StageSerialize]
+        << ",\"compress_ns\":" << r.Sender.StageTime[StageCompress]
+        << ",\"decompress_ns\":" << r.Receiver.StageTime[StageDecompress]
+        << ",\"deserialize_ns\":" << r.Receiver.StageTime[StageDeserialize]
+        << ",\"latency_p50_us\":" << percentile(r.Latencies, 0.50) / 1000
+        << ",\"latency_p99_us\":" << percentile(r.Latencies, 0.99) / 1000
+        << ",\"latency_max_us\":" << percentile(r.Latencies, 1.0) / 1000
+        << "}\n";
+    out.flush();
+    return !r.TimedOut;
+}
+
+static bool waitFor(BenchGP *receiver, unsigned long long count)
+{
+    QElapsedTimer deadline;
+    deadline.start();
+    while (receiver->received < count)
+    {
+        if (deadline.elapsed() > 600000)
+            return false;
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        if (receiver->received < count)
+            QThread::yieldCurrentThread();
+    }
+    return true;
+}
+
+static Result benchMemory(const QString &mix, const QList<QHash<QString, QVariant> > &packets, int compression, bool mt)
+{
+    Result r;
+    r.Path = "memory";
+    r.Mix = mix;
+    r.Compression = compression;
+    r.MT = mt;
+    r.Packets = static_cast<unsigned long long>(packets.size());
+    BenchGP sender;
+    BenchGP receiver(nullptr, mt);
+    sender.SetCompression(compression);
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray stream;
+    foreach (QHash<QString, QVariant> packet, packets)
+    {
+        packet.insert("t", QVariant(bench_clock.nsecsElapsed()));
+        stream += sender.Frame(packet);
+    }
+    r.SendNs = timer.nsecsElapsed();
+    r.WireBytes = static_cast<unsigned long long>(stream.size());
+    // Feed the data in chunks similar to what we get from socket
+    const int chunk = 64 * 1024;
+    for (int offset = 0; offset < stream.size(); offset += chunk)
+        receiver.Feed(stream.mid(offset, chunk));
+    r.TimedOut = !waitFor(&receiver, r.Packets);
+    r.TotalNs = timer.nsecsElapsed();
+    r.Latencies = receiver.GetLatencies();
+    r.Sender = sender.GetStatistics();
+    r.Receiver = receiver.GetStatistics();
+    return r;
+}
+
+static void benchConnection(Result &r, BenchGP &sender, BenchGP &receiver, const QList<QHash<QString, QVariant> > &packets)
+{
+    receiver.ResolveSignals();
+    sender.SetCompression(r.Compression);
+    QElapsedTimer timer;
+    timer.start();
+    qint64 send_time = 0;
+    foreach (QHash<QString, QVariant> packet, packets)
+    {
+        qint64 before = timer.nsecsElapsed();
+        packet.insert("t", QVariant(bench_clock.nsecsElapsed()));
+        sender.SendPacket(packet);
+        send_time += timer.nsecsElapsed() - before;
+        // Let the other side read the data, otherwise we would only measure how fast we fill the socket buffer
+        QCoreApplication::processEvents();
+    }
+    r.TimedOut = !waitFor(&receiver, r.Packets);
+    r.TotalNs = timer.nsecsElapsed();
+    r.SendNs = send_time;
+    r.Latencies = receiver.GetLatencies();
+    r.Sender = sender.GetStatistics();
+    r.Receiver = receiver.GetStatistics();
+    r.WireBytes = r.Receiver.RawBytesRecv;
+}
+
+static Result emptyResult(const QString &path, const QString &mix, const QList<QHash<QString, QVariant> > &packets, int compression, bool mt)
+{
+    Result r;
+    r.Path = path;
+    r.Mix = mix;
+    r.Compression = compression;
+    r.MT = mt;
+    r.Packets = static_cast<unsigned long long>(packets.size());
+    r.SendNs = 0;
+    r.TotalNs = 0;
+    r.TimedOut = false;
+    r.WireBytes = 0;
+    return r;
+}
+
+static Result benchLoopback(const QString &mix, const QList<QHash<QString, QVariant> > &packets, int compression, bool mt)
+{
+    Result r = emptyResult("loopback", mix, packets, compression, mt);
+    QTcpServer server;
+    if (!server.listen(QHostAddress::LocalHost, 0))
+        return r;
+    QTcpSocket *client_socket = new QTcpSocket();
+    client_socket->connectToHost(QHostAddress::LocalHost, server.serverPort());
+    if (!client_socket->waitForConnected(5000) || !server.waitForNewConnection(5000))
+    {
+        delete client_socket;
+        return r;
+    }
+    BenchGP sender(client_socket);
+    BenchGP receiver(server.nextPendingConnection(), mt);
+    benchConnection(r, sender, receiver, packets);
+    return r;
+}
+
+static Result benchLocal(const QString &mix, const QList<QHash<QString, QVariant> > &packets, int compression, bool mt)
+{
+    Result r = emptyResult("local", mix, packets, compression, mt);
+    QLocalServer server;
+    QString name = "gpbench-" + QString::number(QCoreApplication::applicationPid());
+    QLocalServer::removeServer(name);
+    if (!server.listen(name))
+        return r;
+    QLocalSocket *client_socket = new QLocalSocket();
+    client_socket->connectToServer(name);
+    if (!client_socket->waitForConnected(5000) || !server.waitForNewConnection(5000))
+    {
+        delete client_socket;
+        return r;
+    }
+    BenchGP sender;
+    sender.SetLocalSocket(client_socket);
+    BenchGP receiver(nullptr, mt);
+    receiver.SetLocalSocket(server.nextPendingConnection());
+    benchConnection(r, sender, receiver, packets);
+    return r;
+}
+
+static int benchReplay(const QString &path, bool paced, bool mt)
+{
+    Replay replay(path);
+    if (!replay.Open())
+    {
+        QTextStream(stderr) << "Unable to open capture " << path << "\n";
+        return 1;
+    }
+    BenchGP receiver(nullptr, mt);
+    QElapsedTimer timer;
+    timer.start();
+    unsigned long long bytes = replay.Feed(&receiver, paced);
+    // In multithreaded mode we need to wait for the decoder thread to finish all frames that were received
+    StatisticsSnapshot stats = receiver.GetStatistics();
+    unsigned long long frames = 0;
+    for (int i = 0; i < GP_STAT_SIZE_BUCKETS; i++)
+        frames += stats.RecvSizeHistogram[i];
+    Result r;
+    r.TimedOut = !waitFor(&receiver, frames);
+    r.Path = "replay";
+    r.Mix = path;
+    // Captured frames carry their own compression level
+    r.Compression = -1;
+    r.MT = mt;
+    r.Packets = receiver.received;
+    r.WireBytes = bytes;
+    r.SendNs = 0;
+    r.TotalNs = timer.nsecsElapsed();
+    r.Receiver = receiver.GetStatistics();
+    QTextStream out(stdout);
+    if (!printResult(out, r))
+        return 1;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QStringList args = QCoreApplication::arguments();
+    bool quick = args.contains("--quick");
+    QStringList mixes;
+    mixes << "tiny" << "medium" << "large" << "mixed";
+    QList<int> levels;
+    for (int i = 0; i <= 9; i++)
+        levels << i;
+    QStringList paths;
+    paths << "memory" << "loopback" << "local";
+    QString replay;
+    bool paced = false;
+    for (int i = 1; i < args.size(); i++)
+    {
+        if (args.at(i) == "--mix" && i + 1 < args.size())
+            mixes = args.at(++i).split(",");
+        else if (args.at(i) == "--compression" && i + 1 < args.size())
+        {
+            levels.clear();
+            foreach (QString level, args.at(++i).split(","))
+                levels << level.toInt();
+        } else if (args.at(i) == "--path" && i + 1 < args.size())
+            paths = args.at(++i).split(",");
+        else if (args.at(i) == "--replay" && i + 1 < args.size())
+            replay = args.at(++i);
+        else if (args.at(i) == "--paced")
+            paced = true;
+        else if (args.at(i) == "--help")
+        {
+            QTextStream(stdout) << "Usage: gpbench [--quick] [--mix tiny,medium,large,mixed] [--compression 0,1,...,9] [--path memory,loopback,local]\n"
+                                << "       gpbench --replay capture_file [--paced]\n";
+            return 0;
+        }
+    }
+    bench_clock.start();
+    if (!replay.isEmpty())
+    {
+        if (benchReplay(replay, paced, false))
+            return 1;
+        return benchReplay(replay, paced, true);
+    }
+    QTextStream out(stdout);
+    // Runs that timed out are still printed (with timeout set to true), but the whole benchmark fails
+    bool ok = true;
+    foreach (QString mix, mixes)
+    {
+        QList<QHash<QString, QVariant> > packets = makeMix(mix, quick);
+        foreach (int level, levels)
+        {
+            for (int mt = 0; mt <= 1; mt++)
+            {
+                if (paths.contains("memory") && !printResult(out, benchMemory(mix, packets, level, mt)))
+                    ok = false;
+                if (paths.contains("loopback") && !printResult(out, benchLoopback(mix, packets, level, mt)))
+                    ok = false;
+                if (paths.contains("local") && !printResult(out, benchLocal(mix, packets, level, mt)))
+                    ok = false;
+            }
+        }
+    }
+    return ok ? 0 : 1;
+}
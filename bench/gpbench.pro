@@ -0,0 +1,11 @@
+QT       += network
+
+QT       -= gui
+
+TARGET = gpbench
+CONFIG += console
+TEMPLATE = app
+
+SOURCES += gpbench.cpp
+
+LIBS += -L$$OUT_PWD/.. -lgp
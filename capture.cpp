@@ -0,0 +1,179 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+#include <QDataStream>
+#include <QMutex>
+#include <QtEndian>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include "capture.h"
+#include "gp.h"
+
+using namespace libgp;
+
+Capture::Capture(const QString &path) : file(path)
+{
+    this->lock = new QMutex();
+}
+
+Capture::~Capture()
+{
+    this->Close();
+    delete this->lock;
+}
+
+bool Capture::Open()
+{
+    QMutexLocker locker(this->lock);
+    if (this->file.isOpen())
+        return true;
+    if (!this->file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    this->file.write(GP_CAPTURE_MAGIC, GP_CAPTURE_MAGIC_SIZE);
+    QDataStream stream(&this->file);
+    GP_INIT_DS(stream);
+    stream << static_cast<quint32>(GP_CAPTURE_VERSION);
+    this->clock.start();
+    return true;
+}
+
+void Capture::Close()
+{
+    QMutexLocker locker(this->lock);
+    if (this->file.isOpen())
+        this->file.close();
+}
+
+bool Capture::IsOpen() const
+{
+    return this->file.isOpen();
+}
+
+void Capture::Record(Direction direction, const QByteArray &data)
+{
+    QMutexLocker locker(this->lock);
+    if (!this->file.isOpen() || data.isEmpty())
+        return;
+    QDataStream stream(&this->file);
+    GP_INIT_DS(stream);
+    stream << static_cast<qint64>(this->clock.nsecsElapsed() / 1000) << static_cast<quint8>(direction) << static_cast<quint32>(data.size());
+    this->file.write(data);
+}
+
+QString Capture::GetPath() const
+{
+    return this->file.fileName();
+}
+
+ReplayRecord::ReplayRecord()
+{
+    this->Time = 0;
+    this->Dir = DirectionIncoming;
+}
+
+Replay::Replay(const QString &path) : file(path)
+{
+    this->map = nullptr;
+    this->size = 0;
+    this->position = 0;
+}
+
+Replay::~Replay()
+{
+    this->Close();
+}
+
+bool Replay::Open()
+{
+    if (this->map)
+        return true;
+    if (!this->file.open(QIODevice::ReadOnly))
+        return false;
+    this->size = this->file.size();
+    if (this->size < GP_CAPTURE_HEADER_SIZE)
+    {
+        this->Close();
+        return false;
+    }
+    this->map = this->file.map(0, this->size);
+    if (!this->map || memcmp(this->map, GP_CAPTURE_MAGIC, GP_CAPTURE_MAGIC_SIZE) != 0 ||
+            qFromBigEndian<quint32>(this->map + GP_CAPTURE_MAGIC_SIZE) != GP_CAPTURE_VERSION)
+    {
+        this->Close();
+        return false;
+    }
+    this->Rewind();
+    return true;
+}
+
+void Replay::Close()
+{
+    if (this->map)
+        this->file.unmap(this->map);
+    this->map = nullptr;
+    this->size = 0;
+    this->position = 0;
+    if (this->file.isOpen())
+        this->file.close();
+}
+
+bool Replay::IsOpen() const
+{
+    return this->map != nullptr;
+}
+
+void Replay::Rewind()
+{
+    this->position = GP_CAPTURE_HEADER_SIZE;
+}
+
+bool Replay::Next(ReplayRecord &record)
+{
+    if (!this->map || this->position + GP_CAPTURE_RECORD_SIZE > this->size)
+        return false;
+    const uchar *header = this->map + this->position;
+    quint32 length = qFromBigEndian<quint32>(header + 9);
+    if (this->position + GP_CAPTURE_RECORD_SIZE + length > this->size)
+        return false;
+    record.Time = qFromBigEndian<qint64>(header);
+    record.Dir = static_cast<Direction>(header[8]);
+    // No copy here, the array points to mapped memory which stays valid until Close()
+    record.Data = QByteArray::fromRawData(reinterpret_cast<const char*>(header + GP_CAPTURE_RECORD_SIZE), static_cast<int>(length));
+    this->position += GP_CAPTURE_RECORD_SIZE + length;
+    return true;
+}
+
+unsigned long long Replay::Feed(GP *gp, bool paced, Direction direction)
+{
+    unsigned long long bytes = 0;
+    ReplayRecord record;
+    QElapsedTimer timer;
+    timer.start();
+    qint64 first = -1;
+    while (this->Next(record))
+    {
+        if (record.Dir != direction)
+            continue;
+        if (paced)
+        {
+            if (first < 0)
+                first = record.Time;
+            qint64 delay = (record.Time - first) - timer.nsecsElapsed() / 1000;
+            if (delay > 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(delay));
+        }
+        bytes += static_cast<unsigned long long>(record.Data.size());
+        gp->processIncoming(record.Data);
+    }
+    return bytes;
+}
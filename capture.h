@@ -0,0 +1,113 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "gp_global.h"
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+
+#define GP_CAPTURE_MAGIC          "GPCAP\r\n"
+#define GP_CAPTURE_MAGIC_SIZE     8
+#define GP_CAPTURE_VERSION        1
+// magic + version
+#define GP_CAPTURE_HEADER_SIZE    12
+// timestamp (8 bytes) + direction (1 byte) + length (4 bytes)
+#define GP_CAPTURE_RECORD_SIZE    13
+
+class QMutex;
+
+namespace libgp
+{
+    class GP;
+
+    enum Direction
+    {
+        DirectionIncoming = 0,
+        DirectionOutgoing = 1
+    };
+
+    //! Records raw byte stream of a connection into a file
+
+    //! Capture file format (all integers are big endian, same as GP header)
+    //! +----------+---------+
+    //! | MAGIC(8) | VERSION |   file header, version is 4 bytes long
+    //! +----------+---------+-----------+--------------+
+    //! | TIME     | DIRECTION | LENGTH  | DATA         |   record, repeated until end of file
+    //! +----------+-----------+---------+--------------+
+    //!
+    //! TIME is 8 bytes long number of microseconds since the capture was started, DIRECTION is 1 byte
+    //! and LENGTH 4 bytes long size of DATA. Data are exactly what was read from or written to socket.
+    class GPSHARED_EXPORT Capture
+    {
+        public:
+            Capture(const QString &path);
+            ~Capture();
+            bool Open();
+            void Close();
+            bool IsOpen() const;
+            void Record(Direction direction, const QByteArray &data);
+            QString GetPath() const;
+
+        private:
+            QFile file;
+            QElapsedTimer clock;
+            QMutex *lock;
+    };
+
+    //! Single record of capture file, data point directly into the mapped file
+    class GPSHARED_EXPORT ReplayRecord
+    {
+        public:
+            ReplayRecord();
+            qint64 Time;
+            Direction Dir;
+            QByteArray Data;
+    };
+
+    //! Reads capture file created by Capture using memory mapping and replays it
+
+    //! The data can be fed into any instance of GP (that doesn't even need to be connected), so that
+    //! decoding and dispatching of real traffic can be profiled offline
+    class GPSHARED_EXPORT Replay
+    {
+        public:
+            Replay(const QString &path);
+            ~Replay();
+            bool Open();
+            void Close();
+            bool IsOpen() const;
+            //! Moves to first record of capture
+            void Rewind();
+            //! Reads next record, returns false when there are no more records (or the file is truncated)
+            bool Next(ReplayRecord &record);
+            /*!
+             * \brief Feed all records of given direction to processIncoming of GP
+             * \param gp        target protocol instance
+             * \param paced     if true the records are fed with same delays as they were captured, otherwise at full speed
+             * \param direction which side of connection should be replayed
+             * \return number of bytes that were fed
+             */
+            unsigned long long Feed(GP *gp, bool paced = false, Direction direction = DirectionIncoming);
+
+        private:
+            QFile file;
+            uchar *map;
+            qint64 size;
+            qint64 position;
+    };
+}
+
+#endif // CAPTURE_H
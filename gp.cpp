@@ -10,11 +10,16 @@
 
 // Copyright (c) Petr Bena 2015 - 2018
 
+#include <QLocalSocket>
 #include <QTcpSocket>
 #include <QSslSocket>
 #include <QDataStream>
 #include <QMutex>
+#include <QStringList>
+#include <QThread>
 #include <QTimer>
+#include <QUuid>
+#include "capture.h"
 #include "thread.h"
 #include "gp_exception.h"
 #include "gp.h"
@@ -36,18 +41,45 @@ using namespace libgp;
 GP::GP(QTcpSocket *tcp_socket, bool mt)
 {
     this->socket = tcp_socket;
+    this->localSocket = nullptr;
+    this->stats = new Statistics(Statistics::Global());
+    this->capture = nullptr;
+    this->resumeEnabled = false;
+    this->sessionEstablished = false;
+    this->resumePending = false;
+    this->resumeAccepted = false;
+    this->sendSeq = 0;
+    this->writtenSeq = 0;
+    this->recvSeq = 0;
+    this->lastAckSent = 0;
+    this->replayBufferBytes = 0;
+    this->MaxReplayPackets = 10000;
+    this->MaxReplayBytes = 16 * 1024 * 1024;
+    this->lastRequestID = 0;
+    this->requestTimer = new QTimer(this);
+    connect(this->requestTimer, SIGNAL(timeout()), this, SLOT(OnRequestTimer()));
     this->ResetCounters();
     // We don't want to receive single packet bigger than 10MB
     this->MaxIncomingCacheSize = 10 * 1024 * 1024;
+    this->MaxQueuedBytes = 64 * 1024 * 1024;
+    this->MaxQueuedFrames = 0;
+    this->mtBufferBytes = 0;
+    this->receivingPaused = false;
+    this->resumeScheduled = false;
     this->incomingPacketSize = 0;
     this->minimumSizeForComp = 64;
     this->timeout = 60;
     this->incomingPacketCompressionLevel = 0;
     this->mutex = new QMutex(QMutex::Recursive);
     this->mtLock = new QMutex(QMutex::Recursive);
+    this->stateLock = new QMutex(QMutex::Recursive);
     this->compression = 0;
     this->isSSL = false;
     this->timer = nullptr;
+    this->pingID = 0;
+    this->lastPingReplyID = 0;
+    this->clock.start();
+    this->lastPing = 0;
     if (!mt)
     {
         this->thread = nullptr;
@@ -62,10 +94,25 @@ GP::GP(QTcpSocket *tcp_socket, bool mt)
 
 GP::~GP()
 {
+    if (this->thread)
+    {
+        this->thread->Stop();
+        this->thread->wait();
+    }
+    // Callbacks are not called here, they could touch this object while it's being destroyed,
+    // requests only fail through Disconnect or connection error
+    this->pendingRequests.clear();
     delete this->thread;
+    // Remove frames that were never decoded from global queue depth
+    for (int i = 0; i < this->mtBuffer.size(); i++)
+        this->stats->FrameDequeued(static_cast<unsigned long long>(this->mtBuffer.at(i).second.size()));
+    delete this->stats;
+    delete this->capture;
     delete this->timer;
     delete this->mtLock;
+    delete this->stateLock;
     delete this->socket;
+    delete this->localSocket;
     delete this->mutex;
 }
 
@@ -73,7 +120,12 @@ void GP::Connect(const QString &host, int port, bool ssl)
 {
     if (this->IsConnected())
         throw new libgp::GP_Exception("You can't connect using protocol that is already connected");
+    // Remove socket of previous connection, so that only one transport is ever used
+    this->closeSocket();
     this->isSSL = ssl;
+    // New connection means new state on the other side, unless the session is going to be resumed
+    if (!this->resumeEnabled)
+        this->resetDeltaCache();
     if (ssl)
         this->socket = new QSslSocket();
     else
@@ -92,12 +144,50 @@ void GP::Connect(const QString &host, int port, bool ssl)
         //if (!((QSslSocket*)this->socket)->waitForEncrypted())
         //    this->closeError("SSL handshake failed: " + this->socket->errorString(), GP_ESSLHANDSHAKEFAILED);
     }
-    this->lastPTS = 0;
+    this->StartPing();
+}
+
+void GP::ConnectLocal(const QString &name)
+{
+    if (this->IsConnected())
+        throw new libgp::GP_Exception("You can't connect using protocol that is already connected");
+    this->closeSocket();
+    this->isSSL = false;
+    if (!this->resumeEnabled)
+        this->resetDeltaCache();
+    this->localSocket = new QLocalSocket();
+    this->ResolveSignals();
+    connect(this->localSocket, SIGNAL(connected()), this, SLOT(OnConnected()));
+    this->localSocket->connectToServer(name);
+    this->StartPing();
+}
+
+void GP::SetLocalSocket(QLocalSocket *local_socket)
+{
+    if (this->IsConnected())
+        throw new libgp::GP_Exception("You can't change socket of protocol that is already connected");
+    if (local_socket == this->localSocket)
+        return;
+    this->closeSocket();
+    this->localSocket = local_socket;
+}
+
+bool GP::IsLocal() const
+{
+    return this->localSocket != nullptr;
+}
+
+void GP::StartPing()
+{
+    this->mutex->lock();
+    this->rttStats.Reset();
+    this->mutex->unlock();
     if (this->timeout > 0)
     {
-        this->lastPing = QDateTime::currentDateTime();
+        this->lastPing = this->clock.nsecsElapsed() / 1000;
         delete this->timer;
         this->pingID = 0;
+        this->lastPingReplyID = 0;
         this->timer = new QTimer();
         connect(this->timer, SIGNAL(timeout()), this, SLOT(OnPingSend()));
         this->timer->start(13000);
@@ -106,14 +196,16 @@ void GP::Connect(const QString &host, int port, bool ssl)
 
 bool GP::IsConnected() const
 {
-    if (!this->socket)
+    QIODevice *io = this->device();
+    if (!io)
         return false;
-    return this->socket->isOpen();
+    return io->isOpen();
 }
 
 void GP::OnPingSend()
 {
-    if (this->lastPing.secsTo(QDateTime::currentDateTime()) > this->timeout)
+    qint64 now = this->clock.nsecsElapsed() / 1000;
+    if ((now - this->lastPing) / 1000000 > this->timeout)
     {
         this->closeError("Ping timeout", GP_ERROR);
         return;
@@ -121,7 +213,10 @@ void GP::OnPingSend()
     QHash<QString, QVariant> pack;
     pack.insert("type", QVariant(GP_TYPE_PING));
     pack.insert("n", QVariant(++this->pingID));
-    pack.insert("p", QVariant(QDateTime::currentDateTime()));
+    // Other side just sends this value back to us, so we can use our own monotonic clock here
+    pack.insert("p", QVariant(now));
+    if (this->resumeEnabled)
+        pack.insert("a", QVariant(this->recvSeq));
     this->SendPacket(pack);
 }
 
@@ -130,10 +225,26 @@ void GP::OnError(QAbstractSocket::SocketError er)
     emit this->Event_SocketError(er);
 }
 
+void GP::OnLocalError(QLocalSocket::LocalSocketError er)
+{
+    // Values of local socket errors are same as values of their QAbstractSocket counterparts
+    this->OnError(static_cast<QAbstractSocket::SocketError>(er));
+}
+
 void GP::OnReceive()
 {
-    QByteArray incoming_data = this->socket->readAll();
-    this->recvRAWBytes += static_cast<unsigned long long>(incoming_data.size());
+    // Leave the data in socket, once its read buffer is full the TCP window closes and the other side has to wait
+    if (this->receivingPaused)
+        return;
+    QByteArray incoming_data = this->device()->readAll();
+    if (this->capture)
+    {
+        this->mutex->lock();
+        if (this->capture)
+            this->capture->Record(DirectionIncoming, incoming_data);
+        this->mutex->unlock();
+    }
+    this->stats->RawBytesReceived(static_cast<unsigned long long>(incoming_data.size()));
     this->processIncoming(incoming_data);
 }
 
@@ -148,28 +259,103 @@ void GP::OnSslHandshakeFailure(const QList<QSslError> &el)
 
 void GP::OnConnected()
 {
+    if (this->resumeEnabled)
+    {
+        // Tell the server who we are, if this is a reconnect it will send us what we missed
+        this->mutex->lock();
+        QHash<QString, QVariant> hello;
+        hello.insert("type", QVariant(GP_TYPE_RESUME));
+        hello.insert("t", QVariant(this->sessionToken));
+        hello.insert("r", QVariant(this->recvSeq));
+        hello.insert("new", QVariant(!this->sessionEstablished));
+        this->resumePending = this->sessionEstablished;
+        this->sessionEstablished = true;
+        this->mutex->unlock();
+        this->sendResumeControl(hello);
+    }
     emit this->Event_Connected();
 }
 
 void GP::OnDisconnect()
 {
+    if (!this->resumeEnabled)
+        this->failPendingRequests();
     emit this->Event_Disconnected();
 }
 
+void GP::OnResumeReceiving()
+{
+    this->resumeScheduled = false;
+    if (!this->receivingPaused)
+        return;
+    this->receivingPaused = false;
+    if (!this->device())
+        return;
+    this->setReadBufferSize(0);
+    // readyRead is not emitted again for data that are already buffered, so read them now
+    if (this->device()->bytesAvailable() > 0)
+        this->OnReceive();
+}
+
+void GP::OnRequestTimer()
+{
+    qint64 now = this->clock.nsecsElapsed() / 1000;
+    QList<gp_reply_callback_t> expired;
+    this->mutex->lock();
+    QHash<quint64, QPair<gp_reply_callback_t, qint64> >::iterator i = this->pendingRequests.begin();
+    while (i != this->pendingRequests.end())
+    {
+        if (i.value().second <= now)
+        {
+            expired.append(i.value().first);
+            i = this->pendingRequests.erase(i);
+        } else
+        {
+            ++i;
+        }
+    }
+    if (this->pendingRequests.isEmpty())
+        this->requestTimer->stop();
+    this->mutex->unlock();
+    foreach (gp_reply_callback_t callback, expired)
+    {
+        if (callback)
+            callback(false, 0, QHash<QString, QVariant>());
+    }
+}
+
 void GP::OnIncomingCommand(gp_command_t text, const QHash<QString, QVariant> &parameters)
 {
     emit this->Event_IncomingCommand(text, parameters);
 }
 
+void GP::OnIncomingRequest(gp_command_t text, const QHash<QString, QVariant> &parameters, quint64 request_id)
+{
+    emit this->Event_IncomingRequest(text, parameters, request_id);
+}
+
 void GP::processPacket()
 {
+    this->stats->PacketReceived(GP_HEADER_SIZE + static_cast<unsigned long long>(this->incomingCache.size()));
     if (this->isMultithreaded)
     {
         // Store this byte array into fifo for later processing by processor thread
         this->mtLock->lock();
-        this->mtBuffer.append(this->incomingCache);
+        // Frames of one connection don't have to use same compression, so the level travels with each of them
+        this->mtBuffer.append(qMakePair(this->incomingPacketCompressionLevel, this->incomingCache));
+        this->mtBufferBytes += static_cast<unsigned long long>(this->incomingCache.size());
+        this->stats->FrameQueued(static_cast<unsigned long long>(this->incomingCache.size()));
+        if (!this->receivingPaused && this->device() &&
+                ((this->MaxQueuedBytes && this->mtBufferBytes >= this->MaxQueuedBytes) ||
+                 (this->MaxQueuedFrames && static_cast<quint32>(this->mtBuffer.size()) >= this->MaxQueuedFrames)))
+        {
+            // Decoder thread is falling behind, stop reading from socket until it catches up
+            this->receivingPaused = true;
+            this->setReadBufferSize(GP_FLOW_READ_BUFFER);
+        }
         this->mtLock->unlock();
         this->incomingPacketSize = 0;
+        this->incomingPacketCompressionLevel = 0;
         this->incomingCache.clear();
         return;
     }
@@ -186,8 +372,47 @@ void GP::processPacket(QHash<QString, QVariant> pack)
         return;
     }
 
+    // Sequence number belongs to protocol, dispatchPacket and Event_Incoming never see it
+    quint64 seq = pack.take(GP_SEQ_KEY).toULongLong();
+    if (seq && this->resumeEnabled)
+    {
+        bool send_ack = false;
+        this->mutex->lock();
+        if (seq <= this->recvSeq)
+        {
+            // We already have this one, it was resent during resumption
+            this->mutex->unlock();
+            return;
+        }
+        this->recvSeq = seq;
+        if (seq - this->lastAckSent >= GP_RESUME_ACK_INTERVAL)
+        {
+            this->lastAckSent = seq;
+            send_ack = true;
+        }
+        this->mutex->unlock();
+        if (send_ack)
+        {
+            QHash<QString, QVariant> ack;
+            ack.insert("type", QVariant(GP_TYPE_RESUME));
+            ack.insert("a", QVariant(seq));
+            this->sendResumeControl(ack);
+        }
+    }
+
+    this->stats->PacketProcessed();
+    if (pack["type"].toInt() == GP_TYPE_DELTA)
+    {
+        // Wrapper is internal, only the packet rebuilt from it is dispatched
+        this->processDelta(pack);
+        return;
+    }
+    this->dispatchPacket(pack);
+}
+
+void GP::dispatchPacket(const QHash<QString, QVariant> &pack)
+{
     emit this->Event_Incoming(pack);
-    this->recvPackets++;
     int type = pack["type"].toInt();
     switch (type)
     {
@@ -201,11 +426,30 @@ void GP::processPacket(QHash<QString, QVariant> pack)
             QHash<QString, QVariant> parameters;
             if (pack.contains("parameters"))
                 parameters = pack["parameters"].toHash();
-            this->OnIncomingCommand(pack["cid"].toUInt(), parameters);
+            if (pack.contains("re"))
+            {
+                // Reply to one of our requests
+                quint64 id = pack["re"].toULongLong();
+                this->mutex->lock();
+                bool found = this->pendingRequests.contains(id);
+                gp_reply_callback_t callback = this->pendingRequests.take(id).first;
+                this->mutex->unlock();
+                // If we don't know this request it already timed out
+                if (found && callback)
+                    callback(true, pack["cid"].toUInt(), parameters);
+            } else if (pack.contains("rid"))
+            {
+                this->OnIncomingRequest(pack["cid"].toUInt(), parameters, pack["rid"].toULongLong());
+            } else
+            {
+                this->OnIncomingCommand(pack["cid"].toUInt(), parameters);
+            }
         }
             break;
         case GP_TYPE_PING:
         {
+            if (pack.contains("a"))
+                this->trimReplayBuffer(pack["a"].toULongLong());
             if (pack.contains("p"))
             {
                 QHash<QString, QVariant> re;
@@ -216,7 +460,16 @@ void GP::processPacket(QHash<QString, QVariant> pack)
             }
             else if (pack.contains("o"))
             {
-                this->lastPTS = (unsigned long long)pack["o"].toDateTime().msecsTo(QDateTime::currentDateTime());
+                qint64 rtt = (this->clock.nsecsElapsed() / 1000) - pack["o"].toLongLong();
+                unsigned long long id = pack["n"].toULongLong();
+                this->mutex->lock();
+                // Every ping that was sent before this one and wasn't answered yet is considered lost
+                if (id > this->lastPingReplyID + 1)
+                    this->rttStats.RecordLoss(id - this->lastPingReplyID - 1);
+                if (id > this->lastPingReplyID)
+                    this->lastPingReplyID = id;
+                this->rttStats.Record(rtt);
+                this->mutex->unlock();
             }
             else
             {
@@ -225,12 +478,15 @@ void GP::processPacket(QHash<QString, QVariant> pack)
             }
         }
             break;
+        case GP_TYPE_RESUME:
+            this->processResume(pack);
+            break;
     }
 }
 
 void GP::processIncoming(QByteArray data)
 {
-    this->lastPing = QDateTime::currentDateTime();
+    this->lastPing = this->clock.nsecsElapsed() / 1000;
     if (this->incomingPacketSize)
     {
         // we are already receiving a packet
@@ -297,15 +553,47 @@ void GP::closeError(const QString &error, int code)
         delete this->timer;
         this->timer = nullptr;
     }
-    if (!this->socket)
+    if (!this->device())
         return;
-    if (this->socket->isOpen())
-        this->socket->close();
-    this->socket->deleteLater();
-    this->socket = nullptr;
+    this->closeSocket();
+    if (!this->resumeEnabled)
+        this->failPendingRequests();
     emit this->Event_ConnectionFailed(error, code);
 }
 
+void GP::closeSocket()
+{
+    if (this->socket)
+    {
+        if (this->socket->isOpen())
+            this->socket->close();
+        this->socket->deleteLater();
+        this->socket = nullptr;
+    }
+    if (this->localSocket)
+    {
+        if (this->localSocket->isOpen())
+            this->localSocket->close();
+        this->localSocket->deleteLater();
+        this->localSocket = nullptr;
+    }
+}
+
+QIODevice *GP::device() const
+{
+    if (this->localSocket)
+        return this->localSocket;
+    return this->socket;
+}
+
+void GP::setReadBufferSize(qint64 size)
+{
+    if (this->socket)
+        this->socket->setReadBufferSize(size);
+    else if (this->localSocket)
+        this->localSocket->setReadBufferSize(size);
+}
+
 static QByteArray ToArray(const QHash<QString, QVariant> &data)
 {
     QByteArray result;
@@ -335,21 +623,26 @@ static QByteArray ToArray(gp_byte_t number)
 
 QHash<QString, QVariant> GP::packetFromIncomingCache()
 {
+    QElapsedTimer stage_timer;
     // Uncompress the data first
     if (this->incomingPacketCompressionLevel)
     {
-        this->recvCmprBytes += GP_HEADER_SIZE + static_cast<unsigned long long>(this->incomingCache.size());
+        unsigned long long compressed_size = GP_HEADER_SIZE + static_cast<unsigned long long>(this->incomingCache.size());
         GP_SHIELD(this->incomingCache);
+        stage_timer.start();
         this->incomingCache = qUncompress(this->incomingCache);
-        this->recvBytes += GP_HEADER_SIZE + static_cast<unsigned long long>(this->incomingCache.size());
+        this->stats->RecordTime(StageDecompress, stage_timer.nsecsElapsed());
+        this->stats->PacketDecoded(GP_HEADER_SIZE + static_cast<unsigned long long>(this->incomingCache.size()), compressed_size);
     } else
     {
-        this->recvBytes += GP_HEADER_SIZE + static_cast<unsigned long long>(this->incomingCache.size());
+        this->stats->PacketDecoded(GP_HEADER_SIZE + static_cast<unsigned long long>(this->incomingCache.size()), 0);
     }
+    stage_timer.start();
     QDataStream stream(&this->incomingCache, QIODevice::ReadWrite);
     GP_INIT_DS(stream);
     QHash<QString, QVariant> data;
     stream >> data;
+    this->stats->RecordTime(StageDeserialize, stage_timer.nsecsElapsed());
     this->incomingPacketSize = 0;
     this->incomingPacketCompressionLevel = 0;
     this->incomingCache.clear();
@@ -358,20 +651,25 @@ QHash<QString, QVariant> GP::packetFromIncomingCache()
 
 QHash<QString, QVariant> GP::packetFromRawBytes(QByteArray packet, int compression_level)
 {
+    QElapsedTimer stage_timer;
     if (compression_level)
     {
         GP_SHIELD(packet);
-        this->recvCmprBytes += GP_HEADER_SIZE + static_cast<unsigned long long>(packet.size());
+        unsigned long long compressed_size = GP_HEADER_SIZE + static_cast<unsigned long long>(packet.size());
+        stage_timer.start();
         packet = qUncompress(packet);
-        this->recvBytes += GP_HEADER_SIZE + static_cast<unsigned long long>(packet.size());
+        this->stats->RecordTime(StageDecompress, stage_timer.nsecsElapsed());
+        this->stats->PacketDecoded(GP_HEADER_SIZE + static_cast<unsigned long long>(packet.size()), compressed_size);
     } else
     {
-        this->recvBytes += GP_HEADER_SIZE + static_cast<unsigned long long>(packet.size());
+        this->stats->PacketDecoded(GP_HEADER_SIZE + static_cast<unsigned long long>(packet.size()), 0);
     }
+    stage_timer.start();
     QDataStream stream(&packet, QIODevice::ReadWrite);
     GP_INIT_DS(stream);
     QHash<QString, QVariant> data;
     stream >> data;
+    this->stats->RecordTime(StageDeserialize, stage_timer.nsecsElapsed());
     return data;
 }
 
@@ -397,34 +695,49 @@ void GP::processHeader(QByteArray data)
     this->incomingPacketSize = header;
 }
 
-QByteArray GP::mtPop()
+QByteArray GP::mtPop(gp_byte_t *compression_level)
 {
     QByteArray result;
     this->mtLock->lock();
     if (!this->mtBuffer.empty())
     {
-        result = this->mtBuffer.at(0);
-        this->mtBuffer.removeAt(0);
+        QPair<gp_byte_t, QByteArray> frame = this->mtBuffer.takeFirst();
+        *compression_level = frame.first;
+        result = frame.second;
+        this->mtBufferBytes -= static_cast<unsigned long long>(result.size());
+        this->stats->FrameDequeued(static_cast<unsigned long long>(result.size()));
+        if (this->receivingPaused &&
+                (!this->MaxQueuedBytes || this->mtBufferBytes <= this->MaxQueuedBytes / 2) &&
+                (!this->MaxQueuedFrames || static_cast<quint32>(this->mtBuffer.size()) <= this->MaxQueuedFrames / 2) &&
+                !this->resumeScheduled.exchange(true))
+        {
+            // This is called from decoder thread, socket can only be touched from thread that owns it
+            QMetaObject::invokeMethod(this, "OnResumeReceiving", Qt::QueuedConnection);
+        }
     }
     this->mtLock->unlock();
     return result;
 }
 
-bool GP::SendPacket(const QHash<QString, QVariant> &packet)
+QByteArray GP::frameFromPacket(const QHash<QString, QVariant> &packet, unsigned long long *uncompressed_size)
 {
-    if (!this->socket)
-        return false;
     // Current format of every packet is extremely simple
     // First GP_HEADER_SIZE bytes are the size of packet and compression level
     // Following bytes are the packet itself
+    QElapsedTimer stage_timer;
+    stage_timer.start();
     QByteArray result = ToArray(packet);
+    this->stats->RecordTime(StageSerialize, stage_timer.nsecsElapsed());
     bool using_compression = this->compression;
     if (result.size() < this->minimumSizeForComp)
         using_compression = false;
+    if (uncompressed_size)
+        *uncompressed_size = GP_HEADER_SIZE + static_cast<unsigned long long>(result.size());
     if (using_compression)
     {
-        this->sentBytes += GP_HEADER_SIZE + static_cast<unsigned long long>(result.size());
+        stage_timer.start();
         result = qCompress(result, static_cast<int>(this->compression));
+        this->stats->RecordTime(StageCompress, stage_timer.nsecsElapsed());
     }
     // Header contains 2 integers, first one is a size of whole packet (compressed if compression is used)
     // next one is an identifier of compression used
@@ -436,17 +749,88 @@ bool GP::SendPacket(const QHash<QString, QVariant> &packet)
     if (header.size() != GP_HEADER_SIZE)
         throw new GP_Exception("Invalid header size: " + QString::number(header.size()));
     result.prepend(header);
+    return result;
+}
+
+bool GP::SendPacket(const QHash<QString, QVariant> &packet)
+{
+    unsigned long long uncompressed_size;
+    int type = packet["type"].toInt();
+    if (this->resumeEnabled && type != GP_TYPE_PING && type != GP_TYPE_RESUME)
+    {
+        // Only the sequence number is assigned under lock, frame is built outside of it, so that
+        // senders don't wait for serialization and compression of each other's packets
+        QHash<QString, QVariant> sequenced = packet;
+        this->mutex->lock();
+        quint64 seq = ++this->sendSeq;
+        this->mutex->unlock();
+        sequenced.insert(GP_SEQ_KEY, QVariant(seq));
+        QByteArray frame = this->frameFromPacket(sequenced, &uncompressed_size);
+        QMutexLocker locker(this->mutex);
+        // Receiver drops packets with lower sequence number than the last one it got, so frames
+        // must be written in order, frame that was built sooner than its predecessors waits for them
+        // in replay buffer. Packet is buffered even when there is no connection, so that it can be
+        // delivered once the session is resumed.
+        int position = this->replayBuffer.size();
+        while (position > 0 && this->replayBuffer.at(position - 1).first > seq)
+            position--;
+        this->replayBuffer.insert(position, qMakePair(seq, frame));
+        this->replayBufferBytes += static_cast<unsigned long long>(frame.size());
+        while (!this->replayBuffer.isEmpty() && (static_cast<quint32>(this->replayBuffer.size()) > this->MaxReplayPackets ||
+                                                  this->replayBufferBytes > this->MaxReplayBytes))
+        {
+            QPair<quint64, QByteArray> dropped = this->replayBuffer.takeFirst();
+            this->replayBufferBytes -= static_cast<unsigned long long>(dropped.second.size());
+            if (dropped.first > this->writtenSeq)
+                this->writtenSeq = dropped.first;
+        }
+        for (int i = 0; i < this->replayBuffer.size(); i++)
+        {
+            quint64 next = this->replayBuffer.at(i).first;
+            if (next <= this->writtenSeq)
+                continue;
+            if (next != this->writtenSeq + 1)
+                break;
+            this->writtenSeq = next;
+            if (this->resumePending)
+                continue;
+            const QByteArray &next_frame = this->replayBuffer.at(i).second;
+            this->writeFrame(next_frame, next == seq ? uncompressed_size : static_cast<unsigned long long>(next_frame.size()));
+        }
+        return true;
+    }
+    if (!this->device())
+        return false;
+    QByteArray result = this->frameFromPacket(packet, &uncompressed_size);
+    return this->writeFrame(result, uncompressed_size);
+}
+
+bool GP::writeFrame(const QByteArray &result, unsigned long long uncompressed_size)
+{
+    // Compression level is the last byte of header
+    bool using_compression = result.at(GP_HEADER_SIZE - 1) != 0;
     // We must lock the connection here to prevent multiple threads from writing into same socket thus writing borked data
     // into it
-    this->mutex->lock();
-    this->sentPackets++;
+    QMutexLocker locker(this->mutex);
+    if (!this->device())
+        return false;
     if (!using_compression)
-        this->sentBytes += static_cast<unsigned long long>(result.size());
+        this->stats->PacketSent(static_cast<unsigned long long>(result.size()), uncompressed_size, 0);
     else
-        this->sentCmprBytes += static_cast<unsigned long long>(result.size());
-    this->socket->write(result);
-    this->socket->flush();
-    this->mutex->unlock();
+        this->stats->PacketSent(static_cast<unsigned long long>(result.size()), uncompressed_size, static_cast<unsigned long long>(result.size()));
+    if (this->capture)
+        this->capture->Record(DirectionOutgoing, result);
+    if (this->localSocket)
+    {
+        this->localSocket->write(result);
+        this->localSocket->flush();
+        this->stats->RecordWriteBuffer(this->localSocket->bytesToWrite());
+    } else
+    {
+        this->socket->write(result);
+        this->socket->flush();
+        this->stats->RecordWriteBuffer(this->socket->bytesToWrite());
+    }
     return true;
 }
 
@@ -466,8 +850,246 @@ void GP::SendProtocolCommand(gp_command_t command, const QHash<QString, QVariant
     this->SendPacket(pack);
 }
 
+QHash<QString, QVariant> GP::makeDelta(const QHash<QString, QVariant> &previous, const QHash<QString, QVariant> &current)
+{
+    QHash<QString, QVariant> changes;
+    QHash<QString, QVariant> nested;
+    QStringList removed;
+    QHash<QString, QVariant>::const_iterator i = current.constBegin();
+    while (i != current.constEnd())
+    {
+        QHash<QString, QVariant>::const_iterator old = previous.constFind(i.key());
+        if (old == previous.constEnd())
+        {
+            changes.insert(i.key(), i.value());
+        } else if (old.value().userType() != i.value().userType() || old.value() != i.value())
+        {
+            // QVariant comparison converts types, so 1 equals "1", the type has to be checked on its own
+            if (old.value().type() == QVariant::Hash && i.value().type() == QVariant::Hash)
+                nested.insert(i.key(), QVariant(makeDelta(old.value().toHash(), i.value().toHash())));
+            else
+                changes.insert(i.key(), i.value());
+        }
+        ++i;
+    }
+    for (i = previous.constBegin(); i != previous.constEnd(); ++i)
+    {
+        if (!current.contains(i.key()))
+            removed.append(i.key());
+    }
+    QHash<QString, QVariant> delta;
+    if (!changes.isEmpty())
+        delta.insert("d", QVariant(changes));
+    if (!nested.isEmpty())
+        delta.insert("n", QVariant(nested));
+    if (!removed.isEmpty())
+        delta.insert("x", QVariant(removed));
+    return delta;
+}
+
+QHash<QString, QVariant> GP::applyDelta(QHash<QString, QVariant> data, const QHash<QString, QVariant> &delta)
+{
+    QHash<QString, QVariant> changes = delta["d"].toHash();
+    QHash<QString, QVariant>::const_iterator i = changes.constBegin();
+    while (i != changes.constEnd())
+    {
+        data.insert(i.key(), i.value());
+        ++i;
+    }
+    QHash<QString, QVariant> nested = delta["n"].toHash();
+    for (i = nested.constBegin(); i != nested.constEnd(); ++i)
+        data.insert(i.key(), QVariant(applyDelta(data[i.key()].toHash(), i.value().toHash())));
+    foreach (QString removed, delta["x"].toStringList())
+        data.remove(removed);
+    return data;
+}
+
+bool GP::SendStatePacket(const QString &key, const QHash<QString, QVariant> &packet)
+{
+    return this->sendState(key, packet, false);
+}
+
+bool GP::sendState(const QString &key, const QHash<QString, QVariant> &packet, bool whole)
+{
+    QHash<QString, QVariant> pack;
+    pack.insert("type", QVariant(GP_TYPE_DELTA));
+    pack.insert("k", QVariant(key));
+    // Versions of a key must be written in same order as they are assigned, this is guaranteed by stateLock,
+    // which is held until the frame is written, connection mutex is only held while the cache is updated, so that
+    // other senders and decoder thread don't wait for serialization and compression of state packets
+    QMutexLocker locker(this->stateLock);
+    this->mutex->lock();
+    quint64 base = 0;
+    quint64 version = 1;
+    if (this->deltaSent.contains(key))
+        version = this->deltaSent[key].first + 1;
+    if (this->deltaSent.contains(key) && !whole)
+    {
+        base = this->deltaSent[key].first;
+        pack.insert("d", QVariant(makeDelta(this->deltaSent[key].second, packet)));
+    } else
+    {
+        pack.insert("d", QVariant(packet));
+        this->deltaWholeSent.insert(key, version);
+    }
+    this->deltaSent.insert(key, qMakePair(version, packet));
+    pack.insert("v", QVariant(version));
+    pack.insert("b", QVariant(base));
+    this->mutex->unlock();
+    return this->SendPacket(pack);
+}
+
+void GP::ForgetState(const QString &key)
+{
+    this->mutex->lock();
+    this->deltaSent.remove(key);
+    this->deltaWholeSent.remove(key);
+    this->deltaReceived.remove(key);
+    this->mutex->unlock();
+    QHash<QString, QVariant> pack;
+    pack.insert("type", QVariant(GP_TYPE_DELTA));
+    pack.insert("k", QVariant(key));
+    pack.insert("forget", QVariant(true));
+    this->SendPacket(pack);
+}
+
+void GP::processDelta(const QHash<QString, QVariant> &pack)
+{
+    QString key = pack["k"].toString();
+    if (pack.contains("forget"))
+    {
+        // Peer no longer needs this state, any delta that was already on its way is answered by nack,
+        // which is ignored by the sender, because it doesn't know the key anymore
+        this->mutex->lock();
+        this->deltaSent.remove(key);
+        this->deltaWholeSent.remove(key);
+        this->deltaReceived.remove(key);
+        this->mutex->unlock();
+        return;
+    }
+    if (pack.contains("nack"))
+    {
+        // Peer doesn't have the version we based our delta on, send the last state whole. Every delta that
+        // was already on its way gets its own nack, but only the first one needs the state to be resent, the
+        // others are for versions older than the whole state that was sent after them.
+        QMutexLocker state_locker(this->stateLock);
+        this->mutex->lock();
+        bool known = this->deltaSent.contains(key);
+        bool resent = pack.contains("v") && pack["v"].toULongLong() <= this->deltaWholeSent.value(key);
+        QHash<QString, QVariant> last = this->deltaSent.value(key).second;
+        this->mutex->unlock();
+        if (known && !resent)
+            this->sendState(key, last, true);
+        return;
+    }
+    quint64 version = pack["v"].toULongLong();
+    quint64 base = pack["b"].toULongLong();
+    QHash<QString, QVariant> data = pack["d"].toHash();
+    this->mutex->lock();
+    if (base)
+    {
+        if (!this->deltaReceived.contains(key) || this->deltaReceived[key].first != base)
+        {
+            this->deltaReceived.remove(key);
+            this->mutex->unlock();
+            QHash<QString, QVariant> nack;
+            nack.insert("type", QVariant(GP_TYPE_DELTA));
+            nack.insert("k", QVariant(key));
+            nack.insert("nack", QVariant(true));
+            nack.insert("v", QVariant(version));
+            this->SendPacket(nack);
+            return;
+        }
+        data = applyDelta(this->deltaReceived[key].second, data);
+    }
+    this->deltaReceived.insert(key, qMakePair(version, data));
+    this->mutex->unlock();
+    if (!data.contains("type"))
+    {
+        this->closeError("Broken packet", GP_ERROR);
+        return;
+    }
+    // Dispatch the rebuilt packet as if it was received whole
+    this->dispatchPacket(data);
+}
+
+void GP::resetDeltaCache()
+{
+    QMutexLocker locker(this->mutex);
+    this->deltaSent.clear();
+    this->deltaWholeSent.clear();
+    this->deltaReceived.clear();
+}
+
+quint64 GP::SendRequest(gp_command_t command, const QHash<QString, QVariant> &parameters, gp_reply_callback_t callback, int timeout)
+{
+    this->mutex->lock();
+    quint64 id = ++this->lastRequestID;
+    this->pendingRequests.insert(id, qMakePair(callback, this->clock.nsecsElapsed() / 1000 + static_cast<qint64>(timeout) * 1000));
+    this->mutex->unlock();
+    this->startRequestTimer();
+    QHash<QString, QVariant> pack;
+    pack.insert("type", QVariant(GP_TYPE_SYSTEM));
+    pack.insert("cid", QVariant(command));
+    pack.insert("rid", QVariant(id));
+    if (!parameters.isEmpty())
+        pack.insert("parameters", QVariant(parameters));
+    this->SendPacket(pack);
+    return id;
+}
+
+void GP::SendReply(quint64 request_id, gp_command_t command, const QHash<QString, QVariant> &parameters)
+{
+    QHash<QString, QVariant> pack;
+    pack.insert("type", QVariant(GP_TYPE_SYSTEM));
+    pack.insert("cid", QVariant(command));
+    pack.insert("re", QVariant(request_id));
+    if (!parameters.isEmpty())
+        pack.insert("parameters", QVariant(parameters));
+    this->SendPacket(pack);
+}
+
+int GP::GetPendingRequestCount() const
+{
+    QMutexLocker locker(this->mutex);
+    return this->pendingRequests.size();
+}
+
+void GP::startRequestTimer()
+{
+    // Timer can only be started from thread that owns this object
+    if (QThread::currentThread() == this->thread())
+    {
+        if (!this->requestTimer->isActive())
+            this->requestTimer->start(100);
+    } else
+    {
+        QMetaObject::invokeMethod(this->requestTimer, "start", Qt::QueuedConnection, Q_ARG(int, 100));
+    }
+}
+
+void GP::failPendingRequests()
+{
+    this->mutex->lock();
+    QList<QPair<gp_reply_callback_t, qint64> > pending = this->pendingRequests.values();
+    this->pendingRequests.clear();
+    this->mutex->unlock();
+    for (int i = 0; i < pending.size(); i++)
+    {
+        if (pending.at(i).first)
+            pending.at(i).first(false, 0, QHash<QString, QVariant>());
+    }
+}
+
 void GP::ResolveSignals()
 {
+    if (this->localSocket)
+    {
+        connect(this->localSocket, SIGNAL(readyRead()), this, SLOT(OnReceive()));
+        connect(this->localSocket, SIGNAL(disconnected()), this, SLOT(OnDisconnect()));
+        connect(this->localSocket, SIGNAL(error(QLocalSocket::LocalSocketError)), this, SLOT(OnLocalError(QLocalSocket::LocalSocketError)));
+        return;
+    }
     if (!this->socket)
         throw new GP_Exception("this->socket");
     connect(this->socket, SIGNAL(readyRead()), this, SLOT(OnReceive()));
@@ -477,12 +1099,9 @@ void GP::ResolveSignals()
 
 void GP::Disconnect()
 {
-    if (!this->socket)
-        return;
-    if (this->socket->isOpen())
-        this->socket->close();
-    this->socket->deleteLater();
-    this->socket = nullptr;
+    this->closeSocket();
+    if (!this->resumeEnabled)
+        this->failPendingRequests();
 }
 
 void GP::SetCompression(int level)
@@ -492,43 +1111,207 @@ void GP::SetCompression(int level)
 
 void GP::ResetCounters()
 {
-    this->recvPackets = 0;
-    this->sentPackets = 0;
-    this->sentBytes = 0;
-    this->sentCmprBytes = 0;
-    this->recvCmprBytes = 0;
-    this->recvRAWBytes = 0;
-    this->recvBytes = 0;
+    this->stats->Reset();
 }
 
 unsigned long long GP::GetBytesSent()
 {
-    return this->sentBytes;
+    return this->stats->GetBytesSent();
 }
 
 unsigned long long GP::GetBytesRcvd()
 {
-    return this->recvBytes;
+    return this->stats->GetBytesRecv();
 }
 
 unsigned long long GP::GetCompBytesSent() const
 {
-    return this->sentCmprBytes;
+    return this->stats->GetCompBytesSent();
 }
 
 unsigned long long GP::GetCompBytesRcvd() const
 {
-    return this->recvCmprBytes;
+    return this->stats->GetCompBytesRecv();
 }
 
 unsigned long long GP::GetPacketsSent() const
 {
-    return this->sentPackets;
+    return this->stats->GetPacketsSent();
 }
 
 unsigned long long GP::GetPacketsRecv() const
 {
-    return this->recvPackets;
+    return this->stats->GetPacketsRecv();
+}
+
+void GP::EnableResume(bool enabled)
+{
+    QMutexLocker locker(this->mutex);
+    this->resumeEnabled = enabled;
+    if (enabled && this->sessionToken.isEmpty())
+        this->sessionToken = QUuid::createUuid().toString();
+}
+
+bool GP::IsResumeEnabled() const
+{
+    return this->resumeEnabled;
+}
+
+QString GP::GetSessionToken() const
+{
+    QMutexLocker locker(this->mutex);
+    return this->sessionToken;
+}
+
+QString GP::GetPeerSessionToken() const
+{
+    QMutexLocker locker(this->mutex);
+    return this->peerSessionToken;
+}
+
+bool GP::ResumeFrom(GP *previous, quint64 last_received)
+{
+    if (!previous || previous == this)
+        return false;
+    QHash<QString, QVariant> reply;
+    this->mutex->lock();
+    previous->mutex->lock();
+    if (last_received > previous->sendSeq || (last_received < previous->sendSeq &&
+            (previous->replayBuffer.isEmpty() || previous->replayBuffer.first().first > last_received + 1)))
+    {
+        // Some of packets that peer doesn't have were already dropped from replay buffer
+        previous->mutex->unlock();
+        this->mutex->unlock();
+        return false;
+    }
+    this->resumeEnabled = true;
+    this->resumeAccepted = true;
+    this->sessionToken = previous->sessionToken;
+    this->sendSeq = previous->sendSeq;
+    this->writtenSeq = previous->writtenSeq;
+    this->recvSeq = previous->recvSeq;
+    this->lastAckSent = previous->lastAckSent;
+    this->replayBuffer = previous->replayBuffer;
+    this->replayBufferBytes = previous->replayBufferBytes;
+    this->deltaSent = previous->deltaSent;
+    this->deltaWholeSent = previous->deltaWholeSent;
+    this->deltaReceived = previous->deltaReceived;
+    // Replies to requests that were sent over previous connection come to this one, deadlines of requests
+    // are in microseconds of clock of previous instance, so they are converted to our clock
+    qint64 clock_offset = this->clock.nsecsElapsed() / 1000 - previous->clock.nsecsElapsed() / 1000;
+    QHash<quint64, QPair<gp_reply_callback_t, qint64> >::const_iterator request = previous->pendingRequests.constBegin();
+    while (request != previous->pendingRequests.constEnd())
+    {
+        this->pendingRequests.insert(request.key(), qMakePair(request.value().first, request.value().second + clock_offset));
+        ++request;
+    }
+    if (previous->lastRequestID > this->lastRequestID)
+        this->lastRequestID = previous->lastRequestID;
+    bool has_requests = !this->pendingRequests.isEmpty();
+    previous->pendingRequests.clear();
+    previous->replayBuffer.clear();
+    previous->replayBufferBytes = 0;
+    previous->mutex->unlock();
+    if (has_requests)
+        this->startRequestTimer();
+    this->trimReplayBuffer(last_received);
+    reply.insert("type", QVariant(GP_TYPE_RESUME));
+    reply.insert("ok", QVariant(true));
+    reply.insert("r", QVariant(this->recvSeq));
+    this->sendResumeControl(reply);
+    this->resendReplayBuffer();
+    this->mutex->unlock();
+    return true;
+}
+
+void GP::processResume(const QHash<QString, QVariant> &pack)
+{
+    if (!this->resumeEnabled)
+    {
+        // Client would otherwise wait for an answer forever
+        if (pack.contains("t") && !pack["new"].toBool())
+        {
+            QHash<QString, QVariant> reply;
+            reply.insert("type", QVariant(GP_TYPE_RESUME));
+            reply.insert("ok", QVariant(false));
+            this->sendResumeControl(reply);
+        }
+        return;
+    }
+    if (pack.contains("a"))
+        this->trimReplayBuffer(pack["a"].toULongLong());
+    if (pack.contains("t"))
+    {
+        // Server side, client is introducing itself or asking for resumption
+        this->mutex->lock();
+        this->peerSessionToken = pack["t"].toString();
+        this->resumeAccepted = false;
+        this->mutex->unlock();
+        if (pack["new"].toBool())
+            return;
+        emit this->Event_ResumeRequest(pack["t"].toString(), pack["r"].toULongLong());
+        if (!this->resumeAccepted)
+        {
+            QHash<QString, QVariant> reply;
+            reply.insert("type", QVariant(GP_TYPE_RESUME));
+            reply.insert("ok", QVariant(false));
+            this->sendResumeControl(reply);
+        }
+    } else if (pack.contains("ok"))
+    {
+        // Client side, server answered our resume request
+        if (!pack["ok"].toBool())
+        {
+            // Server doesn't know us anymore, start a brand new session
+            this->mutex->lock();
+            this->resumePending = false;
+            this->sendSeq = 0;
+            this->writtenSeq = 0;
+            this->recvSeq = 0;
+            this->lastAckSent = 0;
+            this->replayBuffer.clear();
+            this->replayBufferBytes = 0;
+            this->deltaSent.clear();
+            this->deltaWholeSent.clear();
+            this->deltaReceived.clear();
+            this->mutex->unlock();
+            emit this->Event_ResumeFailed();
+            return;
+        }
+        this->mutex->lock();
+        this->resumePending = false;
+        this->trimReplayBuffer(pack["r"].toULongLong());
+        this->resendReplayBuffer();
+        this->mutex->unlock();
+        emit this->Event_Resumed();
+    }
+}
+
+void GP::sendResumeControl(const QHash<QString, QVariant> &pack)
+{
+    unsigned long long uncompressed_size;
+    QByteArray frame = this->frameFromPacket(pack, &uncompressed_size);
+    this->writeFrame(frame, uncompressed_size);
+}
+
+void GP::resendReplayBuffer()
+{
+    QMutexLocker locker(this->mutex);
+    // Frames with higher sequence number are still waiting for their predecessors and are written by SendPacket
+    for (int i = 0; i < this->replayBuffer.size() && this->replayBuffer.at(i).first <= this->writtenSeq; i++)
+        this->writeFrame(this->replayBuffer.at(i).second, static_cast<unsigned long long>(this->replayBuffer.at(i).second.size()));
+}
+
+void GP::trimReplayBuffer(quint64 acknowledged)
+{
+    QMutexLocker locker(this->mutex);
+    while (!this->replayBuffer.isEmpty() && this->replayBuffer.first().first <= acknowledged)
+        this->replayBufferBytes -= static_cast<unsigned long long>(this->replayBuffer.takeFirst().second.size());
+}
+
+bool GP::IsReceivingPaused() const
+{
+    return this->receivingPaused;
 }
 
 bool GP::IsReceiving()
@@ -551,4 +1334,50 @@ int GP::GetVersion()
     return GP_VERSION;
 }
 
+qint64 GP::GetLastRTT()
+{
+    QMutexLocker locker(this->mutex);
+    return this->rttStats.GetLast();
+}
+
+RTTStats GP::GetRTTStats()
+{
+    QMutexLocker locker(this->mutex);
+    return this->rttStats;
+}
+
+StatisticsSnapshot GP::GetStatistics() const
+{
+    return this->stats->Snapshot();
+}
+
+bool GP::StartCapture(const QString &path)
+{
+    this->StopCapture();
+    Capture *file = new Capture(path);
+    if (!file->Open())
+    {
+        delete file;
+        return false;
+    }
+    this->mutex->lock();
+    this->capture = file;
+    this->mutex->unlock();
+    return true;
+}
+
+void GP::StopCapture()
+{
+    this->mutex->lock();
+    Capture *file = this->capture;
+    this->capture = nullptr;
+    this->mutex->unlock();
+    delete file;
+}
+
+bool GP::IsCapturing() const
+{
+    return this->capture != nullptr;
+}
+
 
@@ -14,17 +14,25 @@
 #define GP_H
 
 #include "gp_global.h"
+#include "rttstats.h"
+#include "stats.h"
 #include <QObject>
 #include <QHash>
 #include <QSslError>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QAbstractSocket>
+#include <QLocalSocket>
 #include <QString>
-
-// #define GP_WITH_STAT
+#include <QPair>
+#include <QList>
+#include <atomic>
+#include <functional>
 
 typedef unsigned int gp_command_t;
 typedef unsigned char gp_byte_t;
+//! Called when reply to a request arrives (ok is true) or when the request times out or connection is lost (ok is false)
+typedef std::function<void(bool ok, gp_command_t command, const QHash<QString, QVariant> &parameters)> gp_reply_callback_t;
 
 #define GP_INIT_DS(stream) stream.setVersion(QDataStream::Qt_4_0)
 
@@ -39,13 +47,27 @@ typedef unsigned char gp_byte_t;
 #define GP_TYPE_SYSTEM        0
 #define GP_TYPE_COMPRESSION   1
 #define GP_TYPE_PING          2
+#define GP_TYPE_RESUME        3
+#define GP_TYPE_DELTA         4
+// Key of sequence number in packets sent with resumption enabled, it's removed before the packet is dispatched,
+// so application can't use it
+#define GP_SEQ_KEY            "__gp_seq"
+// Default timeout of requests in milliseconds
+#define GP_REQUEST_TIMEOUT    30000
+// Receiver of sequenced packets acknowledges them after this many packets (pings carry acks as well)
+#define GP_RESUME_ACK_INTERVAL 64
+// Size of socket read buffer while receiving is paused by flow control
+#define GP_FLOW_READ_BUFFER   65536
 
+class QIODevice;
 class QTcpSocket;
 class QMutex;
 class QTimer;
 
 namespace libgp
 {
+    class Capture;
+    class Replay;
     class Thread;
 
     //! Grumpy protocol
@@ -77,7 +99,21 @@ namespace libgp
     //! On server side, you need to create your own listener, that will create instance of GP
     //! class with QTcpSocket in constructor, then instead of "Connect" call "ResolveSignals"
     //! to connect event handler for socket operations, since then GP class will handle socket
-    //! on its own
+    //! on its own, optionally followed by StartPing to measure RTT of the client
+    //!
+    //! Peers running on same host can use QLocalSocket (unix domain socket or named pipe) instead
+    //! of TCP, client calls ConnectLocal, server passes the socket from its QLocalServer to
+    //! SetLocalSocket and then calls ResolveSignals. Framing and signals are exactly the same.
+    //!
+    //! Session resumption:
+    //! When both sides call EnableResume, every packet gets a sequence number and the sender keeps
+    //! a bounded buffer of packets that were not acknowledged yet. After a client reconnects using
+    //! the same instance of GP, it asks the server to resume. Server emits Event_ResumeRequest on
+    //! its new connection, application finds the instance of GP that was used by the previous
+    //! connection (using GetPeerSessionToken) and calls ResumeFrom, the handler must be connected
+    //! using direct connection. Then both sides deliver only packets the other side missed. Client
+    //! is informed by Event_Resumed or Event_ResumeFailed, in which case a full resync is needed.
+    //! Packets sent by client while waiting for this are delivered after a successful resume.
     //!
     //!
     //! See this sources for example implementation
@@ -96,13 +132,53 @@ namespace libgp
              * \param ssl  whether SSL is enabled
              */
             virtual void Connect(const QString &host, int port, bool ssl);
+            /*!
+             * \brief Connect to remote server that is running on same host using local socket
+             * \param name name of local server (or path to unix socket)
+             */
+            virtual void ConnectLocal(const QString &name);
+            //! Use local socket instead of TCP socket, this is used by servers instead of passing
+            //! the socket to constructor, it must be called before ResolveSignals
+            void SetLocalSocket(QLocalSocket *local_socket);
+            bool IsLocal() const;
             virtual bool IsConnected() const;
             virtual bool SendPacket(const QHash<QString, QVariant> &packet);
             virtual void SendProtocolCommand(gp_command_t command);
             virtual void SendProtocolCommand(gp_command_t command, const QHash<QString, QVariant> &parameters);
+            /*!
+             * \brief Send a packet that represents state of some object, only fields that changed since
+             *        last packet with same key are transferred, other side rebuilds the whole packet
+             *        before it's dispatched, so receiver doesn't need to care about this at all
+             * \param key    stable identifier of object, for example network and channel name
+             * \param packet whole packet, same as for SendPacket
+             */
+            virtual bool SendStatePacket(const QString &key, const QHash<QString, QVariant> &packet);
+            //! Drop last state of given key (for example when the object it represents no longer exists),
+            //! other side is told to drop it as well, next state packet with this key is sent whole
+            void ForgetState(const QString &key);
+            /*!
+             * \brief Send a protocol command and call the callback once the other side replies to it using SendReply,
+             *        any number of requests can be waiting for reply at same time
+             * \param command    command id
+             * \param parameters parameters of command
+             * \param callback   called at most once, in multithreaded mode replies are delivered from decoder thread.
+             *                   Without resumption pending requests fail when connection is lost or Disconnect is called,
+             *                   with resumption they survive until timeout and ResumeFrom moves them to the new
+             *                   connection. Requests still pending when this object is deleted are dropped without calling it.
+             * \param timeout    time in milliseconds after which the request fails
+             * \return id of request
+             */
+            quint64 SendRequest(gp_command_t command, const QHash<QString, QVariant> &parameters, gp_reply_callback_t callback, int timeout = GP_REQUEST_TIMEOUT);
+            //! Reply to request received by Event_IncomingRequest
+            void SendReply(quint64 request_id, gp_command_t command, const QHash<QString, QVariant> &parameters);
+            int GetPendingRequestCount() const;
             //! Perform connection of Qt signals to internal functions,
             //! use this only if you aren't overriding this class
             virtual void ResolveSignals();
+            //! Start sending pings and checking ping timeout, Connect does this on its own, servers
+            //! call it after ResolveSignals to get RTT statistics of their clients. Clients running
+            //! older versions of this library reply to these pings as well.
+            void StartPing();
             virtual void Disconnect();
             virtual void SetCompression(int level);
             virtual void ResetCounters();
@@ -116,8 +192,47 @@ namespace libgp
             virtual quint32 GetIncomingPacketSize();
             virtual quint32 GetIncomingPacketRecv();
             virtual int GetVersion();
+            //! Round trip time of last ping in microseconds, 0 if we didn't receive any ping reply yet
+            qint64 GetLastRTT();
+            //! Returns a copy of round trip time statistics of this connection
+            RTTStats GetRTTStats();
+            //! Returns a copy of performance statistics of this connection, for
+            //! statistics of all connections use Statistics::Global()->Snapshot()
+            StatisticsSnapshot GetStatistics() const;
+            //! Start recording raw byte stream of this connection (both directions) into a file,
+            //! see Capture for description of format, returns false if file can't be opened
+            bool StartCapture(const QString &path);
+            void StopCapture();
+            bool IsCapturing() const;
             quint32 MaxIncomingCacheSize;
+            //! In multithreaded mode, when there is this many bytes of frames waiting for decoder thread,
+            //! we stop reading from socket until the queue drains to half of it, 0 means no limit
+            quint32 MaxQueuedBytes;
+            //! Same as MaxQueuedBytes but for number of frames
+            quint32 MaxQueuedFrames;
+            //! Returns true if reading from socket is paused, because decoder thread can't keep up
+            bool IsReceivingPaused() const;
+            //! Turns on sequence numbers and replay buffer, needs to be enabled on both sides
+            void EnableResume(bool enabled);
+            bool IsResumeEnabled() const;
+            //! Token identifying the session of this side, it doesn't change on reconnect
+            QString GetSessionToken() const;
+            //! Session token of the other side, it's known after the client sent its resume request
+            QString GetPeerSessionToken() const;
+            /*!
+             * \brief Take over the session of previous connection of same peer, this should be called from handler of Event_ResumeRequest,
+             *        before any request is sent using this instance, pending requests of previous connection are moved here
+             * \param previous      instance of GP that was handling previous connection, it can be deleted afterwards
+             * \param last_received sequence number of last packet the peer received
+             * \return false if the packets the peer missed are no longer in the replay buffer
+             */
+            bool ResumeFrom(GP *previous, quint64 last_received);
+            //! Maximum number of unacknowledged packets kept for resumption
+            quint32 MaxReplayPackets;
+            //! Maximum size of unacknowledged packets kept for resumption
+            quint32 MaxReplayBytes;
             friend class libgp::Thread;
+            friend class libgp::Replay;
 
         signals:
             void Event_Connected();
@@ -128,27 +243,56 @@ namespace libgp
             void Event_Incoming(QHash<QString, QVariant> packet);
             void Event_SslHandshakeFailure(QList<QSslError> el, bool *is_ok);
             void Event_IncomingCommand(gp_command_t text, QHash<QString, QVariant> parameters);
+            //! Other side sent a command using SendRequest and expects reply sent using SendReply with same id
+            void Event_IncomingRequest(gp_command_t text, QHash<QString, QVariant> parameters, quint64 request_id);
+            void Event_ResumeRequest(QString token, quint64 last_received);
+            void Event_Resumed();
+            void Event_ResumeFailed();
 
         protected slots:
             virtual void OnPingSend();
             virtual void OnError(QAbstractSocket::SocketError er);
+            virtual void OnLocalError(QLocalSocket::LocalSocketError er);
             virtual void OnReceive();
             virtual void OnSslHandshakeFailure(const QList<QSslError> &el);
             virtual void OnConnected();
             virtual void OnDisconnect();
+            virtual void OnResumeReceiving();
+            virtual void OnRequestTimer();
 
         protected:
             virtual void OnIncomingCommand(gp_command_t text, const QHash<QString, QVariant> &parameters);
+            virtual void OnIncomingRequest(gp_command_t text, const QHash<QString, QVariant> &parameters, quint64 request_id);
             virtual void processPacket();
             virtual void processPacket(QHash<QString, QVariant> pack);
+            //! Emits Event_Incoming and handles the packet according to its type, this is called for every packet
+            //! the application should see, including state packets rebuilt from deltas, internal keys are already
+            //! removed, so this is the place to override when subclass needs to inspect incoming packets
+            virtual void dispatchPacket(const QHash<QString, QVariant> &pack);
             virtual void processIncoming(QByteArray data);
             virtual void closeError(const QString &error, int code);
+            virtual void processResume(const QHash<QString, QVariant> &pack);
             QHash<QString, QVariant> packetFromIncomingCache();
             QHash<QString, QVariant> packetFromRawBytes(QByteArray packet, int compression_level);
+            //! Serializes the packet and (optionally) compresses it, returns whole frame including
+            //! header that is ready to be written to socket
+            QByteArray frameFromPacket(const QHash<QString, QVariant> &packet, unsigned long long *uncompressed_size = nullptr);
             void processHeader(QByteArray data);
-            QByteArray mtPop();
+            //! Writes a frame produced by frameFromPacket to socket, returns false if there is no socket
+            virtual bool writeFrame(const QByteArray &frame, unsigned long long uncompressed_size);
+            //! Delta of two hashes, it contains values that changed or were added (d), keys that were removed (x)
+            //! and deltas of nested hashes (n), so that a single changed item of a big nested hash doesn't
+            //! mean the whole hash is sent again
+            static QHash<QString, QVariant> makeDelta(const QHash<QString, QVariant> &previous, const QHash<QString, QVariant> &current);
+            static QHash<QString, QVariant> applyDelta(QHash<QString, QVariant> data, const QHash<QString, QVariant> &delta);
+            //! Takes next frame that is waiting for decoder thread, compression level of frame is stored into compression_level
+            QByteArray mtPop(gp_byte_t *compression_level);
             QMutex *mtLock;
-            QList<QByteArray> mtBuffer;
+            //! Frames waiting for decoder thread together with their compression level
+            QList<QPair<gp_byte_t, QByteArray> > mtBuffer;
+            unsigned long long mtBufferBytes;
+            std::atomic<bool> receivingPaused;
+            std::atomic<bool> resumeScheduled;
             QMutex *mutex;
             quint32 incomingPacketSize;
             //! This is a minimum size required for data so that they get compressed, for performance reasons
@@ -157,26 +301,63 @@ namespace libgp
             gp_byte_t compression;
             QByteArray incomingCache;
             QTcpSocket *socket;
+            QLocalSocket *localSocket;
+            //! Returns whichever socket is being used by this connection or nullptr
+            QIODevice *device() const;
+
+            Statistics *stats;
+            Capture *capture;
 
         private:
-#ifdef GP_WITH_STAT
-            unsigned long long largePacketSize;
-            unsigned long long largestPacketSize;
-            QDateTime currentPacketTime;
-#endif
             bool isSSL;
             QTimer *timer;
             unsigned int timeout;
             unsigned long long pingID;
-            unsigned long long lastPTS;
-            QDateTime lastPing;
-            unsigned long long sentBytes;
-            unsigned long long sentPackets;
-            unsigned long long recvPackets;
-            unsigned long long recvBytes;
-            unsigned long long sentCmprBytes;
-            unsigned long long recvCmprBytes;
-            unsigned long long recvRAWBytes;
+            unsigned long long lastPingReplyID;
+            //! Monotonic clock used for ping timestamps and timeout detection
+            QElapsedTimer clock;
+            //! Time of last activity on socket, in microseconds of clock
+            qint64 lastPing;
+            RTTStats rttStats;
+            void closeSocket();
+            void setReadBufferSize(qint64 size);
+            void sendResumeControl(const QHash<QString, QVariant> &pack);
+            void trimReplayBuffer(quint64 acknowledged);
+            //! Writes frames from replay buffer that the peer missed, must be called after the buffer was trimmed
+            void resendReplayBuffer();
+            void processDelta(const QHash<QString, QVariant> &pack);
+            void resetDeltaCache();
+            //! Keeps order of state packets, it's always locked before mutex, never after it
+            QMutex *stateLock;
+            //! Last version of state packets sent to / received from peer, indexed by key
+            QHash<QString, QPair<quint64, QHash<QString, QVariant> > > deltaSent;
+            QHash<QString, QPair<quint64, QHash<QString, QVariant> > > deltaReceived;
+            //! Version of last state that was sent whole, indexed by key, nacks of older versions are ignored
+            QHash<QString, quint64> deltaWholeSent;
+            bool sendState(const QString &key, const QHash<QString, QVariant> &packet, bool whole);
+            void failPendingRequests();
+            void startRequestTimer();
+            //! Requests waiting for reply, the value is callback and deadline in microseconds of clock
+            QHash<quint64, QPair<gp_reply_callback_t, qint64> > pendingRequests;
+            quint64 lastRequestID;
+            QTimer *requestTimer;
+            bool resumeEnabled;
+            //! Client already connected at least once, so next connection is a resumption
+            bool sessionEstablished;
+            //! Client is waiting for server to confirm resumption, packets are only buffered
+            bool resumePending;
+            bool resumeAccepted;
+            QString sessionToken;
+            QString peerSessionToken;
+            //! Last sequence number that was assigned to a packet
+            quint64 sendSeq;
+            //! Last sequence number that was written to socket (or would be if there was a connection),
+            //! frames are built outside of lock, so it can be lower than sendSeq
+            quint64 writtenSeq;
+            quint64 recvSeq;
+            quint64 lastAckSent;
+            QList<QPair<quint64, QByteArray> > replayBuffer;
+            unsigned long long replayBufferBytes;
             Thread *thread;
             bool isMultithreaded;
     };
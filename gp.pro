@@ -15,12 +15,18 @@ DEFINES += GP_LIBRARY
 
 SOURCES += gp.cpp \
     gp_exception.cpp \
-    thread.cpp
+    thread.cpp \
+    rttstats.cpp \
+    stats.cpp \
+    capture.cpp
 
 HEADERS += gp.h\
         gp_global.h \
     gp_exception.h \
-    thread.h
+    thread.h \
+    rttstats.h \
+    stats.h \
+    capture.h
 
 unix {
     target.path = /usr/lib
@@ -0,0 +1,18 @@
+QT       += network
+
+QT       -= gui
+
+TARGET = gploadgen
+CONFIG += console
+TEMPLATE = app
+
+SOURCES += main.cpp \
+    loadclient.cpp \
+    loadserver.cpp \
+    profile.cpp
+
+HEADERS += loadclient.h \
+    loadserver.h \
+    profile.h
+
+LIBS += -L$$OUT_PWD/.. -lgp
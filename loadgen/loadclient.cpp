@@ -0,0 +1,216 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+#include "loadclient.h"
+#include <QCoreApplication>
+#include <QTextStream>
+#include <algorithm>
+
+using namespace libgp;
+
+LoadOptions::LoadOptions()
+{
+    this->Host = "127.0.0.1";
+    this->Port = GP_DEFAULT_PORT;
+    this->Connections = 1000;
+    this->Ramp = 500;
+    this->Rate = 1;
+    this->Duration = 30;
+    this->Compression = 0;
+}
+
+LoadSession::LoadSession(LoadClient *load_client)
+{
+    this->client = load_client;
+    this->Connected = false;
+    this->Failed = false;
+    this->Credit = 0;
+}
+
+void LoadSession::dispatchPacket(const QHash<QString, QVariant> &pack)
+{
+    if (pack.contains("t"))
+        this->client->RecordLatency(this->client->Now() - pack["t"].toLongLong());
+    GP::dispatchPacket(pack);
+}
+
+static qint64 percentile(const QVector<qint64> &sorted, double p)
+{
+    if (sorted.isEmpty())
+        return 0;
+    return sorted.at(static_cast<int>(p * (sorted.size() - 1)));
+}
+
+LoadClient::LoadClient(const LoadOptions &load_options)
+{
+    this->options = load_options;
+    this->connected = 0;
+    this->failed = 0;
+    this->measuring = false;
+    this->lastTick = 0;
+    this->measureStart = 0;
+    this->measureCPU = 0;
+    this->baseRSS = 0;
+    this->connectedRSS = 0;
+    connect(&this->rampTimer, SIGNAL(timeout()), this, SLOT(OnOpenMore()));
+    connect(&this->tickTimer, SIGNAL(timeout()), this, SLOT(OnTick()));
+}
+
+LoadClient::~LoadClient()
+{
+    qDeleteAll(this->sessions);
+}
+
+void LoadClient::Start()
+{
+    this->clock.start();
+    this->baseRSS = Profile::GetRSS();
+    // Connections are opened in batches every 100ms, so that we don't overflow the listen queue of server
+    this->rampTimer.start(100);
+    this->tickTimer.start(10);
+    this->OnOpenMore();
+    // Don't wait forever for connections that never open
+    QTimer::singleShot((this->options.Connections / qMax(1, this->options.Ramp) + 30) * 1000, this, SLOT(OnRampTimeout()));
+}
+
+void LoadClient::RecordLatency(qint64 nsecs)
+{
+    if (this->measuring)
+        this->latencies.append(nsecs);
+}
+
+qint64 LoadClient::Now() const
+{
+    return this->clock.nsecsElapsed();
+}
+
+void LoadClient::OnOpenMore()
+{
+    int batch = qMax(1, this->options.Ramp / 10);
+    while (batch-- > 0 && this->sessions.size() < this->options.Connections)
+    {
+        LoadSession *session = new LoadSession(this);
+        session->SetCompression(this->options.Compression);
+        connect(session, SIGNAL(Event_Connected()), this, SLOT(OnConnected()));
+        connect(session, SIGNAL(Event_ConnectionFailed(QString,int)), this, SLOT(OnConnectionFailed(QString,int)));
+        connect(session, SIGNAL(Event_SocketError(QAbstractSocket::SocketError)), this, SLOT(OnSocketError(QAbstractSocket::SocketError)));
+        this->sessions.append(session);
+        session->Connect(this->options.Host, this->options.Port, false);
+    }
+    if (this->sessions.size() >= this->options.Connections)
+        this->rampTimer.stop();
+}
+
+void LoadClient::OnConnected()
+{
+    LoadSession *session = static_cast<LoadSession*>(this->sender());
+    session->Connected = true;
+    this->connected++;
+    if (this->connected + this->failed >= this->options.Connections)
+        this->startMeasurement();
+}
+
+void LoadClient::OnConnectionFailed(QString reason, int ec)
+{
+    Q_UNUSED(ec);
+    this->sessionFailed(static_cast<LoadSession*>(this->sender()), reason);
+}
+
+void LoadClient::OnSocketError(QAbstractSocket::SocketError er)
+{
+    this->sessionFailed(static_cast<LoadSession*>(this->sender()), "socket error " + QString::number(static_cast<int>(er)));
+}
+
+void LoadClient::OnRampTimeout()
+{
+    this->startMeasurement();
+}
+
+void LoadClient::OnTick()
+{
+    qint64 now = this->clock.nsecsElapsed();
+    double elapsed = static_cast<double>(now - this->lastTick) / 1000000000.0;
+    this->lastTick = now;
+    foreach (LoadSession *session, this->sessions)
+    {
+        if (!session->Connected)
+            continue;
+        session->Credit += this->options.Rate * elapsed;
+        while (session->Credit >= 1)
+        {
+            session->Credit -= 1;
+            QHash<QString, QVariant> packet = this->options.Traffic.Next();
+            packet.insert("t", QVariant(this->clock.nsecsElapsed()));
+            session->SendPacket(packet);
+        }
+    }
+}
+
+void LoadClient::OnFinish()
+{
+    qint64 now = this->clock.nsecsElapsed();
+    double seconds = static_cast<double>(now - this->measureStart) / 1000000000.0;
+    qint64 cpu = Profile::GetCPUTime() - this->measureCPU;
+    StatisticsSnapshot stats = Statistics::Global()->Snapshot();
+    std::sort(this->latencies.begin(), this->latencies.end());
+    unsigned long long packets = stats.PacketsSent + stats.PacketsRecv;
+    QTextStream out(stdout);
+    out << "{\"role\":\"client\""
+        << ",\"profile\":\"" << this->options.Traffic.ToString() << "\""
+        << ",\"connections\":" << this->connected
+        << ",\"failed\":" << this->failed
+        << ",\"seconds\":" << seconds
+        << ",\"packets_sent\":" << stats.PacketsSent
+        << ",\"packets_recv\":" << stats.PacketsRecv
+        << ",\"packets_per_sec\":" << (seconds > 0 ? static_cast<double>(stats.PacketsRecv) / seconds : 0)
+        << ",\"mb_recv_per_sec\":" << (seconds > 0 ? static_cast<double>(stats.RawBytesRecv) / seconds / (1024 * 1024) : 0)
+        << ",\"latency_p50_us\":" << percentile(this->latencies, 0.50) / 1000
+        << ",\"latency_p90_us\":" << percentile(this->latencies, 0.90) / 1000
+        << ",\"latency_p99_us\":" << percentile(this->latencies, 0.99) / 1000
+        << ",\"latency_p999_us\":" << percentile(this->latencies, 0.999) / 1000
+        << ",\"latency_max_us\":" << percentile(this->latencies, 1.0) / 1000
+        << ",\"rss_bytes_per_connection\":" << (this->connected && this->connectedRSS > this->baseRSS ? (this->connectedRSS - this->baseRSS) / static_cast<unsigned long long>(this->connected) : 0)
+        << ",\"cpu_us_per_packet\":" << (packets ? static_cast<double>(cpu) / static_cast<double>(packets) : 0)
+        << "}\n";
+    out.flush();
+    QCoreApplication::exit(this->connected ? 0 : 1);
+}
+
+void LoadClient::startMeasurement()
+{
+    if (this->measuring)
+        return;
+    this->connectedRSS = Profile::GetRSS();
+    // Everything that happened during ramp up is not part of the results
+    Statistics::Global()->Reset();
+    this->latencies.clear();
+    this->measuring = true;
+    this->measureStart = this->clock.nsecsElapsed();
+    this->measureCPU = Profile::GetCPUTime();
+    QTimer::singleShot(this->options.Duration * 1000, this, SLOT(OnFinish()));
+}
+
+void LoadClient::sessionFailed(LoadSession *session, const QString &reason)
+{
+    if (session->Failed)
+        return;
+    session->Failed = true;
+    if (session->Connected)
+    {
+        session->Connected = false;
+        this->connected--;
+    }
+    this->failed++;
+    QTextStream(stderr) << "Connection failed: " << reason << "\n";
+    if (this->connected + this->failed >= this->options.Connections)
+        this->startMeasurement();
+}
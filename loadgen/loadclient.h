@@ -0,0 +1,96 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+#ifndef LOADCLIENT_H
+#define LOADCLIENT_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include "../gp.h"
+#include "profile.h"
+
+class LoadClient;
+
+class LoadOptions
+{
+    public:
+        LoadOptions();
+        QString Host;
+        quint16 Port;
+        int Connections;
+        //! How many new connections are opened every second
+        int Ramp;
+        //! Packets per second sent by each connection
+        double Rate;
+        //! Length of measurement in seconds, it starts when all connections are open
+        int Duration;
+        int Compression;
+        Profile Traffic;
+};
+
+//! Single client connection, it measures latency of packets echoed back by server
+class LoadSession : public libgp::GP
+{
+    public:
+        LoadSession(LoadClient *load_client);
+        bool Connected;
+        bool Failed;
+        double Credit;
+
+    protected:
+        void dispatchPacket(const QHash<QString, QVariant> &pack) override;
+
+    private:
+        LoadClient *client;
+};
+
+//! Opens many connections to echo server, generates traffic and reports results
+class LoadClient : public QObject
+{
+        Q_OBJECT
+    public:
+        LoadClient(const LoadOptions &load_options);
+        ~LoadClient() override;
+        void Start();
+        void RecordLatency(qint64 nsecs);
+        qint64 Now() const;
+
+    private slots:
+        void OnOpenMore();
+        void OnConnected();
+        void OnConnectionFailed(QString reason, int ec);
+        void OnSocketError(QAbstractSocket::SocketError er);
+        void OnRampTimeout();
+        void OnTick();
+        void OnFinish();
+
+    private:
+        void startMeasurement();
+        void sessionFailed(LoadSession *session, const QString &reason);
+        LoadOptions options;
+        QList<LoadSession*> sessions;
+        QTimer rampTimer;
+        QTimer tickTimer;
+        QElapsedTimer clock;
+        QVector<qint64> latencies;
+        int connected;
+        int failed;
+        bool measuring;
+        qint64 lastTick;
+        qint64 measureStart;
+        qint64 measureCPU;
+        unsigned long long baseRSS;
+        unsigned long long connectedRSS;
+};
+
+#endif // LOADCLIENT_H
@@ -0,0 +1,110 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+#include "loadserver.h"
+#include "profile.h"
+#include <QTcpSocket>
+#include <QTextStream>
+
+using namespace libgp;
+
+EchoSession::EchoSession(QTcpSocket *tcp_socket) : GP(tcp_socket)
+{
+
+}
+
+void EchoSession::dispatchPacket(const QHash<QString, QVariant> &pack)
+{
+    GP::dispatchPacket(pack);
+    if (pack["type"].toInt() != GP_TYPE_PING)
+        this->SendPacket(pack);
+}
+
+LoadServer::LoadServer(int compression_level, int report_interval)
+{
+    this->compression = compression_level;
+    this->baseRSS = Profile::GetRSS();
+    this->lastPackets = 0;
+    this->lastBytes = 0;
+    this->lastCPU = Profile::GetCPUTime();
+    this->clock.start();
+    this->lastTime = 0;
+    connect(&this->server, SIGNAL(newConnection()), this, SLOT(OnNewConnection()));
+    connect(&this->reportTimer, SIGNAL(timeout()), this, SLOT(OnReport()));
+    this->reportTimer.start(report_interval * 1000);
+}
+
+bool LoadServer::Listen(quint16 port)
+{
+    return this->server.listen(QHostAddress::Any, port);
+}
+
+void LoadServer::OnNewConnection()
+{
+    while (this->server.hasPendingConnections())
+    {
+        EchoSession *session = new EchoSession(this->server.nextPendingConnection());
+        session->SetCompression(this->compression);
+        connect(session, SIGNAL(Event_Disconnected()), this, SLOT(OnDisconnected()));
+        connect(session, SIGNAL(Event_ConnectionFailed(QString,int)), this, SLOT(OnConnectionFailed(QString,int)));
+        session->ResolveSignals();
+        this->sessions.append(session);
+    }
+}
+
+void LoadServer::OnDisconnected()
+{
+    this->removeSession(static_cast<EchoSession*>(this->sender()));
+}
+
+void LoadServer::OnConnectionFailed(QString reason, int ec)
+{
+    Q_UNUSED(reason);
+    Q_UNUSED(ec);
+    this->removeSession(static_cast<EchoSession*>(this->sender()));
+}
+
+void LoadServer::OnReport()
+{
+    StatisticsSnapshot stats = Statistics::Global()->Snapshot();
+    qint64 now = this->clock.elapsed();
+    qint64 cpu = Profile::GetCPUTime();
+    unsigned long long packets = stats.PacketsRecv + stats.PacketsSent;
+    unsigned long long bytes = stats.RawBytesRecv;
+    double seconds = static_cast<double>(now - this->lastTime) / 1000;
+    unsigned long long delta_packets = packets - this->lastPackets;
+    unsigned long long rss = Profile::GetRSS();
+    QTextStream out(stdout);
+    out << "{\"role\":\"server\""
+        << ",\"sessions\":" << this->sessions.size()
+        << ",\"packets_per_sec\":" << (seconds > 0 ? static_cast<double>(delta_packets) / seconds : 0)
+        << ",\"mb_recv_per_sec\":" << (seconds > 0 ? static_cast<double>(bytes - this->lastBytes) / seconds / (1024 * 1024) : 0)
+        << ",\"cpu_us_per_packet\":" << (delta_packets ? static_cast<double>(cpu - this->lastCPU) / static_cast<double>(delta_packets) : 0)
+        << ",\"rss_bytes\":" << rss
+        << ",\"rss_bytes_per_session\":" << (this->sessions.isEmpty() || rss < this->baseRSS ? 0 : (rss - this->baseRSS) / static_cast<unsigned long long>(this->sessions.size()))
+        << ",\"queue_frames_max\":" << stats.QueueFramesMax
+        << ",\"write_buffer_max\":" << stats.WriteBufferMax
+        << "}\n";
+    out.flush();
+    this->lastPackets = packets;
+    this->lastBytes = bytes;
+    this->lastCPU = cpu;
+    this->lastTime = now;
+}
+
+void LoadServer::removeSession(EchoSession *session)
+{
+    if (!session || !this->sessions.contains(session))
+        return;
+    this->sessions.removeOne(session);
+    session->deleteLater();
+}
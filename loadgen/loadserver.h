@@ -0,0 +1,60 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+#ifndef LOADSERVER_H
+#define LOADSERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTimer>
+#include <QList>
+#include "../gp.h"
+
+//! Session of echo server, every packet (except for pings) is sent back to client
+class EchoSession : public libgp::GP
+{
+    public:
+        EchoSession(QTcpSocket *tcp_socket);
+
+    protected:
+        void dispatchPacket(const QHash<QString, QVariant> &pack) override;
+};
+
+//! Echo server used as a counterpart of load generator, it periodically prints its own statistics
+class LoadServer : public QObject
+{
+        Q_OBJECT
+    public:
+        LoadServer(int compression_level, int report_interval);
+        bool Listen(quint16 port);
+
+    private slots:
+        void OnNewConnection();
+        void OnDisconnected();
+        void OnConnectionFailed(QString reason, int ec);
+        void OnReport();
+
+    private:
+        void removeSession(EchoSession *session);
+        QTcpServer server;
+        QTimer reportTimer;
+        QList<EchoSession*> sessions;
+        int compression;
+        unsigned long long baseRSS;
+        unsigned long long lastPackets;
+        unsigned long long lastBytes;
+        qint64 lastCPU;
+        qint64 lastTime;
+        QElapsedTimer clock;
+};
+
+#endif // LOADSERVER_H
@@ -0,0 +1,111 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+// Load generator and soak test tool
+//
+// gploadgen server starts GP echo server, gploadgen client opens many connections to it and
+// generates traffic, both sides print their results as JSON
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+#include "loadclient.h"
+#include "loadserver.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+static void raiseFileLimit()
+{
+#ifdef Q_OS_UNIX
+    // Every connection needs a file descriptor, default soft limit is usually way too low
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+}
+
+static int usage()
+{
+    QTextStream(stdout) << "Usage: gploadgen server [--port P] [--compression L] [--report S]\n"
+                        << "       gploadgen client [--host H] [--port P] [--connections N] [--ramp N]\n"
+                        << "                        [--rate R] [--duration S] [--compression L] [--profile P]\n"
+                        << "\n"
+                        << "  --ramp N      open N new connections per second (default 500)\n"
+                        << "  --rate R      packets per second sent by every connection (default 1)\n"
+                        << "  --duration S  length of measurement once all connections are open (default 30)\n"
+                        << "  --profile P   traffic profile, for example tiny:90,medium:9,large:1 (default tiny)\n"
+                        << "  --report S    how often server prints its statistics (default 5)\n";
+    return 2;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QStringList args = QCoreApplication::arguments();
+    if (args.size() < 2 || (args.at(1) != "server" && args.at(1) != "client"))
+        return usage();
+    raiseFileLimit();
+    LoadOptions options;
+    options.Traffic.Parse("tiny");
+    int report = 5;
+    for (int i = 2; i < args.size(); i++)
+    {
+        QString arg = args.at(i);
+        if (i + 1 >= args.size())
+            return usage();
+        QString value = args.at(++i);
+        if (arg == "--host")
+            options.Host = value;
+        else if (arg == "--port")
+            options.Port = static_cast<quint16>(value.toUInt());
+        else if (arg == "--connections")
+            options.Connections = value.toInt();
+        else if (arg == "--ramp")
+            options.Ramp = value.toInt();
+        else if (arg == "--rate")
+            options.Rate = value.toDouble();
+        else if (arg == "--duration")
+            options.Duration = value.toInt();
+        else if (arg == "--compression")
+            options.Compression = value.toInt();
+        else if (arg == "--report")
+            report = qMax(1, value.toInt());
+        else if (arg == "--profile")
+        {
+            if (!options.Traffic.Parse(value))
+            {
+                QTextStream(stderr) << "Invalid profile: " << value << "\n";
+                return 2;
+            }
+        }
+        else
+            return usage();
+    }
+    if (args.at(1) == "server")
+    {
+        LoadServer server(options.Compression, report);
+        if (!server.Listen(options.Port))
+        {
+            QTextStream(stderr) << "Unable to listen on port " << options.Port << "\n";
+            return 1;
+        }
+        return a.exec();
+    }
+    LoadClient client(options);
+    client.Start();
+    return a.exec();
+}
@@ -0,0 +1,130 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+#include "profile.h"
+#include "../gp.h"
+#include <QFile>
+#include <QStringList>
+#include <ctime>
+
+static QHash<QString, QVariant> systemPacket(gp_command_t command, const QHash<QString, QVariant> &parameters)
+{
+    QHash<QString, QVariant> pack;
+    pack.insert("type", QVariant(GP_TYPE_SYSTEM));
+    pack.insert("cid", QVariant(command));
+    pack.insert("parameters", QVariant(parameters));
+    return pack;
+}
+
+static QHash<QString, QVariant> makeTemplate(const QString &name)
+{
+    QHash<QString, QVariant> parameters;
+    parameters.insert("network_id", QVariant(1));
+    parameters.insert("channel", QVariant(QString("#grumpy")));
+    if (name == "tiny")
+    {
+        parameters.insert("source", QVariant(QString("petan!petan@wikimedia/Petrb")));
+        parameters.insert("text", QVariant(QString("hello world, this is a regular line of text")));
+        return systemPacket(100, parameters);
+    }
+    if (name == "medium")
+    {
+        QHash<QString, QVariant> users;
+        for (int i = 0; i < 50; i++)
+        {
+            QHash<QString, QVariant> user;
+            user.insert("nick", QVariant(QString("user") + QString::number(i)));
+            user.insert("host", QVariant(QString("host-") + QString::number(i) + ".example.org"));
+            users.insert(QString::number(i), QVariant(user));
+        }
+        parameters.insert("users", QVariant(users));
+        return systemPacket(101, parameters);
+    }
+    QList<QVariant> lines;
+    for (int i = 0; i < 2000; i++)
+    {
+        QHash<QString, QVariant> line;
+        line.insert("id", QVariant(i));
+        line.insert("source", QVariant(QString("user") + QString::number(i % 50)));
+        line.insert("text", QVariant(QString("Some longer line of text that was said on channel a long time ago ") + QString::number(i)));
+        lines.append(QVariant(line));
+    }
+    parameters.insert("scrollback", QVariant(lines));
+    return systemPacket(102, parameters);
+}
+
+unsigned long long Profile::GetRSS()
+{
+    // Linux only, elsewhere memory per connection is simply not reported
+    QFile status("/proc/self/status");
+    if (!status.open(QIODevice::ReadOnly))
+        return 0;
+    foreach (QByteArray line, status.readAll().split('\n'))
+    {
+        if (line.startsWith("VmRSS:"))
+            return line.mid(6).trimmed().split(' ').at(0).toULongLong() * 1024;
+    }
+    return 0;
+}
+
+qint64 Profile::GetCPUTime()
+{
+    return static_cast<qint64>(std::clock()) * 1000000 / CLOCKS_PER_SEC;
+}
+
+Profile::Profile()
+{
+    this->totalWeight = 0;
+}
+
+bool Profile::Parse(const QString &definition)
+{
+    this->names.clear();
+    this->weights.clear();
+    this->templates.clear();
+    this->totalWeight = 0;
+    foreach (QString item, definition.split(",", QString::SkipEmptyParts))
+    {
+        QStringList parts = item.split(":");
+        QString name = parts.at(0).trimmed();
+        int weight = 1;
+        if (parts.size() > 1)
+            weight = parts.at(1).toInt();
+        if ((name != "tiny" && name != "medium" && name != "large") || weight <= 0)
+            return false;
+        this->names.append(name);
+        this->weights.append(weight);
+        this->templates.append(makeTemplate(name));
+        this->totalWeight += weight;
+    }
+    return this->totalWeight > 0;
+}
+
+const QHash<QString, QVariant> &Profile::Next()
+{
+    int pick = qrand() % this->totalWeight;
+    int i = 0;
+    while (pick >= this->weights.at(i))
+    {
+        pick -= this->weights.at(i);
+        i++;
+    }
+    return this->templates.at(i);
+}
+
+QString Profile::ToString() const
+{
+    QStringList items;
+    for (int i = 0; i < this->names.size(); i++)
+        items.append(this->names.at(i) + ":" + QString::number(this->weights.at(i)));
+    return items.join(",");
+}
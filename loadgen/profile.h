@@ -0,0 +1,47 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QVariant>
+
+//! Traffic profile, describes what kind of packets are sent by every client
+
+//! Profile is defined by a string in format name:weight,name:weight where name is one of
+//! tiny (IRC line), medium (channel state update) or large (scrollback) for example
+//! tiny:90,medium:9,large:1
+class Profile
+{
+    public:
+        //! Current resident memory of this process in bytes, 0 if unknown
+        static unsigned long long GetRSS();
+        //! CPU time consumed by this process in microseconds
+        static qint64 GetCPUTime();
+
+        Profile();
+        bool Parse(const QString &definition);
+        //! Picks a packet template according to weights of profile
+        const QHash<QString, QVariant> &Next();
+        QString ToString() const;
+
+    private:
+        QList<QString> names;
+        QList<int> weights;
+        QList<QHash<QString, QVariant> > templates;
+        int totalWeight;
+};
+
+#endif // PROFILE_H
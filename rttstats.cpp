@@ -0,0 +1,119 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+#include "rttstats.h"
+
+using namespace libgp;
+
+RTTStats::RTTStats()
+{
+    this->Reset();
+}
+
+void RTTStats::Record(qint64 rtt)
+{
+    if (rtt < 0)
+        rtt = 0;
+    if (!this->samples)
+    {
+        this->min = rtt;
+        this->max = rtt;
+        this->average = static_cast<double>(rtt);
+    } else
+    {
+        if (rtt < this->min)
+            this->min = rtt;
+        if (rtt > this->max)
+            this->max = rtt;
+        // Same gains as used by TCP for SRTT (RFC 6298) and RTP for jitter (RFC 3550)
+        this->average += (static_cast<double>(rtt) - this->average) / 8;
+        this->jitter += (static_cast<double>(qAbs(rtt - this->last)) - this->jitter) / 16;
+    }
+    int bucket = 0;
+    qint64 value = rtt;
+    while (value > 1 && bucket < GP_RTT_BUCKETS - 1)
+    {
+        value >>= 1;
+        bucket++;
+    }
+    this->histogram[bucket]++;
+    this->last = rtt;
+    this->samples++;
+}
+
+void RTTStats::RecordLoss(unsigned long long count)
+{
+    this->lost += count;
+}
+
+void RTTStats::Reset()
+{
+    for (int i = 0; i < GP_RTT_BUCKETS; i++)
+        this->histogram[i] = 0;
+    this->samples = 0;
+    this->lost = 0;
+    this->last = 0;
+    this->min = 0;
+    this->max = 0;
+    this->average = 0;
+    this->jitter = 0;
+}
+
+qint64 RTTStats::GetLast() const
+{
+    return this->last;
+}
+
+qint64 RTTStats::GetMin() const
+{
+    return this->min;
+}
+
+qint64 RTTStats::GetMax() const
+{
+    return this->max;
+}
+
+qint64 RTTStats::GetAverage() const
+{
+    return static_cast<qint64>(this->average);
+}
+
+qint64 RTTStats::GetJitter() const
+{
+    return static_cast<qint64>(this->jitter);
+}
+
+unsigned long long RTTStats::GetSamples() const
+{
+    return this->samples;
+}
+
+unsigned long long RTTStats::GetLost() const
+{
+    return this->lost;
+}
+
+QList<unsigned long long> RTTStats::GetHistogram() const
+{
+    QList<unsigned long long> result;
+    for (int i = 0; i < GP_RTT_BUCKETS; i++)
+        result.append(this->histogram[i]);
+    return result;
+}
+
+qint64 RTTStats::GetBucketLowerBound(int bucket)
+{
+    if (bucket <= 0)
+        return 0;
+    return static_cast<qint64>(1) << bucket;
+}
@@ -0,0 +1,64 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+#ifndef RTTSTATS_H
+#define RTTSTATS_H
+
+#include "gp_global.h"
+#include <QList>
+
+// Number of histogram buckets, bucket N holds samples in range <2^N, 2^(N+1)) microseconds,
+// last bucket holds everything that is bigger (2^23 us is roughly 8 seconds)
+#define GP_RTT_BUCKETS        24
+
+namespace libgp
+{
+    //! Round trip time statistics of a single connection
+
+    //! All values are in microseconds, they are measured using the ping exchange
+    //! that is performed by GP class periodically. The average is exponentially
+    //! weighted moving average (same smoothing as TCP's SRTT) and jitter is computed
+    //! as a smoothed mean deviation of consecutive samples (as in RTP)
+    class GPSHARED_EXPORT RTTStats
+    {
+        public:
+            RTTStats();
+            void Record(qint64 rtt);
+            void RecordLoss(unsigned long long count = 1);
+            void Reset();
+            //! Round trip time of last ping, 0 if no reply was received yet
+            qint64 GetLast() const;
+            qint64 GetMin() const;
+            qint64 GetMax() const;
+            //! Exponentially weighted moving average of round trip time
+            qint64 GetAverage() const;
+            qint64 GetJitter() const;
+            unsigned long long GetSamples() const;
+            //! Number of pings we never received reply to
+            unsigned long long GetLost() const;
+            QList<unsigned long long> GetHistogram() const;
+            //! Returns lowest value (in microseconds) that belongs to given bucket
+            static qint64 GetBucketLowerBound(int bucket);
+
+        private:
+            unsigned long long histogram[GP_RTT_BUCKETS];
+            unsigned long long samples;
+            unsigned long long lost;
+            qint64 last;
+            qint64 min;
+            qint64 max;
+            double average;
+            double jitter;
+    };
+}
+
+#endif // RTTSTATS_H
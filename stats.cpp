@@ -0,0 +1,276 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+#include "stats.h"
+#include <QList>
+
+using namespace libgp;
+
+// None of the counters is used to synchronize anything, relaxed ordering is enough
+#define GP_STAT_ADD(counter, value) counter.fetch_add(value, std::memory_order_relaxed)
+#define GP_STAT_GET(counter) counter.load(std::memory_order_relaxed)
+
+static QVariantList histogramToList(const unsigned long long *histogram, int size)
+{
+    QVariantList result;
+    for (int i = 0; i < size; i++)
+        result.append(QVariant(histogram[i]));
+    return result;
+}
+
+StatisticsSnapshot::StatisticsSnapshot()
+{
+    this->PacketsSent = 0;
+    this->PacketsRecv = 0;
+    this->BytesSent = 0;
+    this->BytesRecv = 0;
+    this->CompBytesSent = 0;
+    this->CompBytesRecv = 0;
+    this->RawBytesRecv = 0;
+    for (int i = 0; i < GP_STAT_SIZE_BUCKETS; i++)
+    {
+        this->SentSizeHistogram[i] = 0;
+        this->RecvSizeHistogram[i] = 0;
+    }
+    for (int i = 0; i < StageCount; i++)
+    {
+        this->StageTime[i] = 0;
+        this->StageCalls[i] = 0;
+    }
+    this->QueueFrames = 0;
+    this->QueueBytes = 0;
+    this->QueueFramesMax = 0;
+    this->QueueBytesMax = 0;
+    this->WriteBufferMax = 0;
+}
+
+QHash<QString, QVariant> StatisticsSnapshot::ToHash() const
+{
+    QHash<QString, QVariant> result;
+    result.insert("packets_sent", QVariant(this->PacketsSent));
+    result.insert("packets_recv", QVariant(this->PacketsRecv));
+    result.insert("bytes_sent", QVariant(this->BytesSent));
+    result.insert("bytes_recv", QVariant(this->BytesRecv));
+    result.insert("comp_bytes_sent", QVariant(this->CompBytesSent));
+    result.insert("comp_bytes_recv", QVariant(this->CompBytesRecv));
+    result.insert("raw_bytes_recv", QVariant(this->RawBytesRecv));
+    result.insert("sent_size_histogram", QVariant(histogramToList(this->SentSizeHistogram, GP_STAT_SIZE_BUCKETS)));
+    result.insert("recv_size_histogram", QVariant(histogramToList(this->RecvSizeHistogram, GP_STAT_SIZE_BUCKETS)));
+    result.insert("serialize_ns", QVariant(this->StageTime[StageSerialize]));
+    result.insert("serialize_calls", QVariant(this->StageCalls[StageSerialize]));
+    result.insert("compress_ns", QVariant(this->StageTime[StageCompress]));
+    result.insert("compress_calls", QVariant(this->StageCalls[StageCompress]));
+    result.insert("decompress_ns", QVariant(this->StageTime[StageDecompress]));
+    result.insert("decompress_calls", QVariant(this->StageCalls[StageDecompress]));
+    result.insert("deserialize_ns", QVariant(this->StageTime[StageDeserialize]));
+    result.insert("deserialize_calls", QVariant(this->StageCalls[StageDeserialize]));
+    result.insert("queue_frames", QVariant(this->QueueFrames));
+    result.insert("queue_bytes", QVariant(this->QueueBytes));
+    result.insert("queue_frames_max", QVariant(this->QueueFramesMax));
+    result.insert("queue_bytes_max", QVariant(this->QueueBytesMax));
+    result.insert("write_buffer_max", QVariant(this->WriteBufferMax));
+    return result;
+}
+
+Statistics *Statistics::Global()
+{
+    static Statistics global;
+    return &global;
+}
+
+Statistics::Statistics(Statistics *parent)
+{
+    this->parent = parent;
+    this->queueFrames = 0;
+    this->queueBytes = 0;
+    this->Reset();
+}
+
+void Statistics::PacketSent(unsigned long long frame_size, unsigned long long bytes, unsigned long long comp_bytes)
+{
+    GP_STAT_ADD(this->packetsSent, 1);
+    GP_STAT_ADD(this->bytesSent, bytes);
+    GP_STAT_ADD(this->compBytesSent, comp_bytes);
+    GP_STAT_ADD(this->sentSizeHistogram[sizeBucket(frame_size)], 1);
+    if (this->parent)
+        this->parent->PacketSent(frame_size, bytes, comp_bytes);
+}
+
+void Statistics::PacketReceived(unsigned long long frame_size)
+{
+    GP_STAT_ADD(this->recvSizeHistogram[sizeBucket(frame_size)], 1);
+    if (this->parent)
+        this->parent->PacketReceived(frame_size);
+}
+
+void Statistics::PacketDecoded(unsigned long long bytes, unsigned long long comp_bytes)
+{
+    GP_STAT_ADD(this->bytesRecv, bytes);
+    GP_STAT_ADD(this->compBytesRecv, comp_bytes);
+    if (this->parent)
+        this->parent->PacketDecoded(bytes, comp_bytes);
+}
+
+void Statistics::PacketProcessed()
+{
+    GP_STAT_ADD(this->packetsRecv, 1);
+    if (this->parent)
+        this->parent->PacketProcessed();
+}
+
+void Statistics::RawBytesReceived(unsigned long long bytes)
+{
+    GP_STAT_ADD(this->rawBytesRecv, bytes);
+    if (this->parent)
+        this->parent->RawBytesReceived(bytes);
+}
+
+void Statistics::RecordTime(Stage stage, qint64 nsecs)
+{
+    if (nsecs < 0)
+        nsecs = 0;
+    GP_STAT_ADD(this->stageTime[stage], static_cast<unsigned long long>(nsecs));
+    GP_STAT_ADD(this->stageCalls[stage], 1);
+    if (this->parent)
+        this->parent->RecordTime(stage, nsecs);
+}
+
+void Statistics::FrameQueued(unsigned long long bytes)
+{
+    updateMax(this->queueFramesMax, GP_STAT_ADD(this->queueFrames, 1) + 1);
+    updateMax(this->queueBytesMax, GP_STAT_ADD(this->queueBytes, bytes) + bytes);
+    if (this->parent)
+        this->parent->FrameQueued(bytes);
+}
+
+void Statistics::FrameDequeued(unsigned long long bytes)
+{
+    this->queueFrames.fetch_sub(1, std::memory_order_relaxed);
+    this->queueBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    if (this->parent)
+        this->parent->FrameDequeued(bytes);
+}
+
+void Statistics::RecordWriteBuffer(qint64 bytes)
+{
+    if (bytes <= 0)
+        return;
+    updateMax(this->writeBufferMax, static_cast<unsigned long long>(bytes));
+    if (this->parent)
+        this->parent->RecordWriteBuffer(bytes);
+}
+
+void Statistics::Reset()
+{
+    this->packetsSent = 0;
+    this->packetsRecv = 0;
+    this->bytesSent = 0;
+    this->bytesRecv = 0;
+    this->compBytesSent = 0;
+    this->compBytesRecv = 0;
+    this->rawBytesRecv = 0;
+    for (int i = 0; i < GP_STAT_SIZE_BUCKETS; i++)
+    {
+        this->sentSizeHistogram[i] = 0;
+        this->recvSizeHistogram[i] = 0;
+    }
+    for (int i = 0; i < StageCount; i++)
+    {
+        this->stageTime[i] = 0;
+        this->stageCalls[i] = 0;
+    }
+    // Queue depth is not a counter but a state, so only high-water marks are reset here
+    this->queueFramesMax = GP_STAT_GET(this->queueFrames);
+    this->queueBytesMax = GP_STAT_GET(this->queueBytes);
+    this->writeBufferMax = 0;
+}
+
+StatisticsSnapshot Statistics::Snapshot() const
+{
+    StatisticsSnapshot result;
+    result.PacketsSent = GP_STAT_GET(this->packetsSent);
+    result.PacketsRecv = GP_STAT_GET(this->packetsRecv);
+    result.BytesSent = GP_STAT_GET(this->bytesSent);
+    result.BytesRecv = GP_STAT_GET(this->bytesRecv);
+    result.CompBytesSent = GP_STAT_GET(this->compBytesSent);
+    result.CompBytesRecv = GP_STAT_GET(this->compBytesRecv);
+    result.RawBytesRecv = GP_STAT_GET(this->rawBytesRecv);
+    for (int i = 0; i < GP_STAT_SIZE_BUCKETS; i++)
+    {
+        result.SentSizeHistogram[i] = GP_STAT_GET(this->sentSizeHistogram[i]);
+        result.RecvSizeHistogram[i] = GP_STAT_GET(this->recvSizeHistogram[i]);
+    }
+    for (int i = 0; i < StageCount; i++)
+    {
+        result.StageTime[i] = GP_STAT_GET(this->stageTime[i]);
+        result.StageCalls[i] = GP_STAT_GET(this->stageCalls[i]);
+    }
+    result.QueueFrames = GP_STAT_GET(this->queueFrames);
+    result.QueueBytes = GP_STAT_GET(this->queueBytes);
+    result.QueueFramesMax = GP_STAT_GET(this->queueFramesMax);
+    result.QueueBytesMax = GP_STAT_GET(this->queueBytesMax);
+    result.WriteBufferMax = GP_STAT_GET(this->writeBufferMax);
+    return result;
+}
+
+unsigned long long Statistics::GetPacketsSent() const
+{
+    return GP_STAT_GET(this->packetsSent);
+}
+
+unsigned long long Statistics::GetPacketsRecv() const
+{
+    return GP_STAT_GET(this->packetsRecv);
+}
+
+unsigned long long Statistics::GetBytesSent() const
+{
+    return GP_STAT_GET(this->bytesSent);
+}
+
+unsigned long long Statistics::GetBytesRecv() const
+{
+    return GP_STAT_GET(this->bytesRecv);
+}
+
+unsigned long long Statistics::GetCompBytesSent() const
+{
+    return GP_STAT_GET(this->compBytesSent);
+}
+
+unsigned long long Statistics::GetCompBytesRecv() const
+{
+    return GP_STAT_GET(this->compBytesRecv);
+}
+
+unsigned long long Statistics::GetRawBytesRecv() const
+{
+    return GP_STAT_GET(this->rawBytesRecv);
+}
+
+int Statistics::sizeBucket(unsigned long long size)
+{
+    int bucket = 0;
+    while (size > 1 && bucket < GP_STAT_SIZE_BUCKETS - 1)
+    {
+        size >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void Statistics::updateMax(std::atomic<unsigned long long> &max, unsigned long long value)
+{
+    unsigned long long current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        ;
+}
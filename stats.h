@@ -0,0 +1,126 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "gp_global.h"
+#include <QHash>
+#include <QString>
+#include <QVariant>
+#include <atomic>
+
+// Packet size histogram buckets, bucket N holds packets with size in range <2^N, 2^(N+1)) bytes
+#define GP_STAT_SIZE_BUCKETS  32
+
+namespace libgp
+{
+    //! Stages of packet processing that are being timed
+    enum Stage
+    {
+        StageSerialize,
+        StageCompress,
+        StageDecompress,
+        StageDeserialize,
+        StageCount
+    };
+
+    //! Plain copy of statistics taken at some point in time
+    class GPSHARED_EXPORT StatisticsSnapshot
+    {
+        public:
+            StatisticsSnapshot();
+            //! Converts the snapshot to a hash, so that it can be easily exported (or even sent over GP)
+            QHash<QString, QVariant> ToHash() const;
+            unsigned long long PacketsSent;
+            unsigned long long PacketsRecv;
+            unsigned long long BytesSent;
+            unsigned long long BytesRecv;
+            unsigned long long CompBytesSent;
+            unsigned long long CompBytesRecv;
+            unsigned long long RawBytesRecv;
+            //! Size of frames as they were written to socket (header included)
+            unsigned long long SentSizeHistogram[GP_STAT_SIZE_BUCKETS];
+            //! Size of frames as they were read from socket (header included)
+            unsigned long long RecvSizeHistogram[GP_STAT_SIZE_BUCKETS];
+            //! Total time spent in each stage, in nanoseconds
+            unsigned long long StageTime[StageCount];
+            unsigned long long StageCalls[StageCount];
+            //! Frames waiting for decoder thread (only used in multithreaded mode)
+            unsigned long long QueueFrames;
+            unsigned long long QueueBytes;
+            unsigned long long QueueFramesMax;
+            unsigned long long QueueBytesMax;
+            //! Largest amount of data that was waiting in write buffer of socket after flush
+            unsigned long long WriteBufferMax;
+    };
+
+    //! Performance statistics of a connection
+
+    //! All counters are atomic, so they can be safely updated from network thread as well as from
+    //! decoder thread and read from anywhere without any locking. Every instance that has a parent
+    //! forwards all updates to it as well, this is used to maintain process-wide aggregate that
+    //! can be obtained using Statistics::Global()
+    class GPSHARED_EXPORT Statistics
+    {
+        public:
+            //! Statistics of all connections in this process
+            static Statistics *Global();
+
+            Statistics(Statistics *parent = nullptr);
+            Statistics(const Statistics &) = delete;
+            Statistics &operator=(const Statistics &) = delete;
+            void PacketSent(unsigned long long frame_size, unsigned long long bytes, unsigned long long comp_bytes);
+            void PacketReceived(unsigned long long frame_size);
+            void PacketDecoded(unsigned long long bytes, unsigned long long comp_bytes);
+            void PacketProcessed();
+            void RawBytesReceived(unsigned long long bytes);
+            void RecordTime(Stage stage, qint64 nsecs);
+            void FrameQueued(unsigned long long bytes);
+            void FrameDequeued(unsigned long long bytes);
+            void RecordWriteBuffer(qint64 bytes);
+            //! Resets all counters of this instance, parent is not affected
+            void Reset();
+            StatisticsSnapshot Snapshot() const;
+            //! Single counters, these are much cheaper than taking whole snapshot
+            unsigned long long GetPacketsSent() const;
+            unsigned long long GetPacketsRecv() const;
+            unsigned long long GetBytesSent() const;
+            unsigned long long GetBytesRecv() const;
+            unsigned long long GetCompBytesSent() const;
+            unsigned long long GetCompBytesRecv() const;
+            unsigned long long GetRawBytesRecv() const;
+
+        private:
+            static int sizeBucket(unsigned long long size);
+            static void updateMax(std::atomic<unsigned long long> &max, unsigned long long value);
+            Statistics *parent;
+            std::atomic<unsigned long long> packetsSent;
+            std::atomic<unsigned long long> packetsRecv;
+            std::atomic<unsigned long long> bytesSent;
+            std::atomic<unsigned long long> bytesRecv;
+            std::atomic<unsigned long long> compBytesSent;
+            std::atomic<unsigned long long> compBytesRecv;
+            std::atomic<unsigned long long> rawBytesRecv;
+            std::atomic<unsigned long long> sentSizeHistogram[GP_STAT_SIZE_BUCKETS];
+            std::atomic<unsigned long long> recvSizeHistogram[GP_STAT_SIZE_BUCKETS];
+            std::atomic<unsigned long long> stageTime[StageCount];
+            std::atomic<unsigned long long> stageCalls[StageCount];
+            std::atomic<unsigned long long> queueFrames;
+            std::atomic<unsigned long long> queueBytes;
+            std::atomic<unsigned long long> queueFramesMax;
+            std::atomic<unsigned long long> queueBytesMax;
+            std::atomic<unsigned long long> writeBufferMax;
+    };
+}
+
+#endif // STATS_H
@@ -0,0 +1,400 @@
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU Lesser General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU Lesser General Public License for more details.
+
+// Copyright (c) Petr Bena 2015 - 2018
+
+// Tests of protocol state machines of GP
+//
+// Everything runs in memory, there are no sockets, frames written by one instance are collected by overridden writeFrame
+// and fed to processIncoming of the other one, so tests can decide which frames are delivered, lost
+// or duplicated. Program returns 0 if all checks passed.
+
+#include <QCoreApplication>
+#include <QLocalSocket>
+#include <QStringList>
+#include <QTextStream>
+#include "../gp.h"
+
+using namespace libgp;
+
+static int failures = 0;
+
+#define GP_CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            QTextStream(stderr) << __FILE__ << ":" << __LINE__ << ": check failed: " << #condition << "\n"; \
+            failures++; \
+        } \
+    } while (0)
+
+class TestGP : public GP
+{
+    public:
+        TestGP()
+        {
+            // Socket is never connected, it only makes GP believe it has a transport,
+            // frames are taken from writeFrame instead
+            this->SetLocalSocket(new QLocalSocket());
+        }
+        QByteArray Frame(const QHash<QString, QVariant> &packet)
+        {
+            return this->frameFromPacket(packet);
+        }
+        void Feed(const QByteArray &data)
+        {
+            this->processIncoming(data);
+        }
+        //! Same as if the socket just connected
+        void Connected()
+        {
+            this->OnConnected();
+        }
+        static QHash<QString, QVariant> Delta(const QHash<QString, QVariant> &previous, const QHash<QString, QVariant> &current)
+        {
+            return makeDelta(previous, current);
+        }
+        static QHash<QString, QVariant> Apply(const QHash<QString, QVariant> &data, const QHash<QString, QVariant> &delta)
+        {
+            return applyDelta(data, delta);
+        }
+        //! Frames written by this instance that were not delivered yet
+        QList<QByteArray> Outbox;
+        //! Packets that were dispatched to application, except for resumption control packets
+        QList<QHash<QString, QVariant> > Received;
+        //! Ids of requests received from other side
+        QList<quint64> Requests;
+
+    protected:
+        bool writeFrame(const QByteArray &frame, unsigned long long uncompressed_size) override
+        {
+            Q_UNUSED(uncompressed_size);
+            this->Outbox.append(frame);
+            return true;
+        }
+        void dispatchPacket(const QHash<QString, QVariant> &pack) override
+        {
+            if (pack["type"].toInt() != GP_TYPE_RESUME)
+                this->Received.append(pack);
+            GP::dispatchPacket(pack);
+        }
+        void OnIncomingRequest(gp_command_t text, const QHash<QString, QVariant> &parameters, quint64 request_id) override
+        {
+            this->Requests.append(request_id);
+            GP::OnIncomingRequest(text, parameters, request_id);
+        }
+};
+
+// Plays the role of server application, which looks up previous connection of resuming client
+class ResumeHandler : public QObject
+{
+        Q_OBJECT
+    public:
+        ResumeHandler(GP *current, GP *previous)
+        {
+            this->current = current;
+            this->previous = previous;
+            this->Accepted = false;
+            connect(current, SIGNAL(Event_ResumeRequest(QString,quint64)), this, SLOT(OnResumeRequest(QString,quint64)), Qt::DirectConnection);
+        }
+        bool Accepted;
+
+    public slots:
+        void OnResumeRequest(QString token, quint64 last_received)
+        {
+            if (token == this->previous->GetPeerSessionToken())
+                this->Accepted = this->current->ResumeFrom(this->previous, last_received);
+        }
+
+    private:
+        GP *current;
+        GP *previous;
+};
+
+// Delivers everything one side wrote to the other one, returns number of delivered frames
+static int deliver(TestGP *from, TestGP *to)
+{
+    QList<QByteArray> frames = from->Outbox;
+    from->Outbox.clear();
+    foreach (QByteArray frame, frames)
+        to->Feed(frame);
+    return frames.size();
+}
+
+// Unlike QHash::operator== this doesn't consider values of different types equal
+static bool sameHash(const QHash<QString, QVariant> &a, const QHash<QString, QVariant> &b)
+{
+    if (a.size() != b.size())
+        return false;
+    QHash<QString, QVariant>::const_iterator i = a.constBegin();
+    while (i != a.constEnd())
+    {
+        if (!b.contains(i.key()))
+            return false;
+        QVariant other = b[i.key()];
+        if (i.value().userType() != other.userType())
+            return false;
+        if (i.value().type() == QVariant::Hash)
+        {
+            if (!sameHash(i.value().toHash(), other.toHash()))
+                return false;
+        } else if (i.value() != other)
+        {
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+
+static QHash<QString, QVariant> channelState(const QString &topic, const QString &modes_of_last_user)
+{
+    QHash<QString, QVariant> users;
+    for (int i = 0; i < 100; i++)
+    {
+        QHash<QString, QVariant> user;
+        user.insert("nick", QVariant(QString(QString("user") + QString::number(i))));
+        user.insert("host", QVariant(QString(QString("host-") + QString::number(i) + ".example.org")));
+        user.insert("modes", QVariant(i == 99 ? modes_of_last_user : QString()));
+        users.insert(QString::number(i), QVariant(user));
+    }
+    QHash<QString, QVariant> parameters;
+    parameters.insert("channel", QVariant(QString("#grumpy")));
+    parameters.insert("topic", QVariant(topic));
+    parameters.insert("users", QVariant(users));
+    QHash<QString, QVariant> pack;
+    pack.insert("type", QVariant(GP_TYPE_SYSTEM));
+    pack.insert("cid", QVariant(101));
+    pack.insert("parameters", QVariant(parameters));
+    return pack;
+}
+
+static void testDeltaNested()
+{
+    QHash<QString, QVariant> previous = channelState("topic", "");
+    QHash<QString, QVariant> current = channelState("topic", "o");
+    QHash<QString, QVariant> delta = TestGP::Delta(previous, current);
+    // Only a single nested value changed, so nothing is sent on top level
+    GP_CHECK(!delta.contains("d"));
+    GP_CHECK(!delta.contains("x"));
+    GP_CHECK(delta["n"].toHash().contains("parameters"));
+    GP_CHECK(sameHash(TestGP::Apply(previous, delta), current));
+    GP_CHECK(TestGP::Delta(current, current).isEmpty());
+}
+
+static void testDeltaTypeChange()
+{
+    QHash<QString, QVariant> previous;
+    previous.insert("type", QVariant(GP_TYPE_SYSTEM));
+    previous.insert("number", QVariant(1));
+    previous.insert("flag", QVariant(true));
+    previous.insert("text", QVariant(QString("same")));
+    QHash<QString, QVariant> current = previous;
+    current.insert("number", QVariant(QString("1")));
+    current.insert("flag", QVariant(1));
+    QHash<QString, QVariant> delta = TestGP::Delta(previous, current);
+    QHash<QString, QVariant> changes = delta["d"].toHash();
+    GP_CHECK(changes.contains("number"));
+    GP_CHECK(changes.contains("flag"));
+    GP_CHECK(!changes.contains("text"));
+    QHash<QString, QVariant> result = TestGP::Apply(previous, delta);
+    GP_CHECK(result["number"].userType() == QMetaType::QString);
+    GP_CHECK(result["flag"].userType() == QMetaType::Int);
+    GP_CHECK(sameHash(result, current));
+}
+
+static void testDeltaRemovedKeys()
+{
+    QHash<QString, QVariant> nested;
+    nested.insert("x", QVariant(1));
+    nested.insert("y", QVariant(2));
+    QHash<QString, QVariant> previous;
+    previous.insert("type", QVariant(GP_TYPE_SYSTEM));
+    previous.insert("a", QVariant(1));
+    previous.insert("b", QVariant(2));
+    previous.insert("p", QVariant(nested));
+    QHash<QString, QVariant> current = previous;
+    current.remove("b");
+    nested.remove("y");
+    current.insert("p", QVariant(nested));
+    QHash<QString, QVariant> delta = TestGP::Delta(previous, current);
+    GP_CHECK(delta["x"].toStringList() == QStringList("b"));
+    GP_CHECK(delta["n"].toHash()["p"].toHash()["x"].toStringList() == QStringList("y"));
+    GP_CHECK(sameHash(TestGP::Apply(previous, delta), current));
+}
+
+static void testStateSync()
+{
+    TestGP sender;
+    TestGP receiver;
+    QHash<QString, QVariant> s1 = channelState("one", "");
+    QHash<QString, QVariant> s2 = channelState("two", "");
+    sender.SendStatePacket("c", s1);
+    int whole_size = sender.Outbox.first().size();
+    deliver(&sender, &receiver);
+    GP_CHECK(receiver.Received.size() == 1);
+    GP_CHECK(sameHash(receiver.Received.last(), s1));
+
+    sender.SendStatePacket("c", s2);
+    GP_CHECK(sender.Outbox.first().size() < whole_size);
+    deliver(&sender, &receiver);
+    GP_CHECK(receiver.Received.size() == 2);
+    GP_CHECK(sameHash(receiver.Received.last(), s2));
+
+    // Delta is lost, the two that follow are based on it, so receiver rejects both
+    sender.SendStatePacket("c", channelState("three", ""));
+    sender.Outbox.clear();
+    sender.SendStatePacket("c", channelState("four", ""));
+    QHash<QString, QVariant> s5 = channelState("five", "v");
+    sender.SendStatePacket("c", s5);
+    deliver(&sender, &receiver);
+    GP_CHECK(receiver.Received.size() == 2);
+    GP_CHECK(receiver.Outbox.size() == 2);
+    deliver(&receiver, &sender);
+    // Only first nack results in whole state being resent
+    GP_CHECK(sender.Outbox.size() == 1);
+    deliver(&sender, &receiver);
+    GP_CHECK(receiver.Received.size() == 3);
+    GP_CHECK(sameHash(receiver.Received.last(), s5));
+    GP_CHECK(receiver.Outbox.isEmpty());
+
+    // After the state is forgotten, next one is sent whole and accepted without nack
+    sender.ForgetState("c");
+    deliver(&sender, &receiver);
+    sender.SendStatePacket("c", s1);
+    GP_CHECK(sender.Outbox.first().size() >= whole_size);
+    deliver(&sender, &receiver);
+    GP_CHECK(receiver.Received.size() == 4);
+    GP_CHECK(sameHash(receiver.Received.last(), s1));
+    GP_CHECK(receiver.Outbox.isEmpty());
+}
+
+// Returns command ids of packets dispatched by given instance, in order in which they were dispatched
+static QList<int> commands(const TestGP &gp)
+{
+    QList<int> result;
+    foreach (QHash<QString, QVariant> pack, gp.Received)
+        result.append(pack["cid"].toInt());
+    return result;
+}
+
+static QHash<QString, QVariant> sequenced(quint64 seq, int command)
+{
+    QHash<QString, QVariant> pack;
+    pack.insert("type", QVariant(GP_TYPE_SYSTEM));
+    pack.insert("cid", QVariant(command));
+    pack.insert(GP_SEQ_KEY, QVariant(seq));
+    return pack;
+}
+
+static void testSequenceDuplicates()
+{
+    TestGP sender;
+    TestGP receiver;
+    receiver.EnableResume(true);
+    QByteArray f1 = sender.Frame(sequenced(1, 1));
+    QByteArray f2 = sender.Frame(sequenced(2, 2));
+    QByteArray f3 = sender.Frame(sequenced(3, 3));
+    receiver.Feed(f1);
+    receiver.Feed(f2);
+    receiver.Feed(f2);
+    receiver.Feed(f1);
+    // Frame may arrive in more pieces
+    receiver.Feed(f3.left(3));
+    receiver.Feed(f3.mid(3));
+    GP_CHECK(commands(receiver) == QList<int>() << 1 << 2 << 3);
+    foreach (QHash<QString, QVariant> pack, receiver.Received)
+        GP_CHECK(!pack.contains(GP_SEQ_KEY));
+}
+
+static void testResume()
+{
+    TestGP client;
+    TestGP server1;
+    client.EnableResume(true);
+    server1.EnableResume(true);
+    client.Connected();
+    deliver(&client, &server1);
+    GP_CHECK(server1.GetPeerSessionToken() == client.GetSessionToken());
+
+    client.SendProtocolCommand(1);
+    server1.SendProtocolCommand(101);
+    int replies = 0;
+    bool reply_ok = false;
+    server1.SendRequest(102, QHash<QString, QVariant>(), [&](bool ok, gp_command_t command, const QHash<QString, QVariant> &parameters)
+    {
+        Q_UNUSED(command);
+        Q_UNUSED(parameters);
+        replies++;
+        reply_ok = ok;
+    });
+    QByteArray old_frame = server1.Outbox.first();
+    deliver(&client, &server1);
+    deliver(&server1, &client);
+    GP_CHECK(commands(server1) == QList<int>() << 1);
+    GP_CHECK(commands(client) == QList<int>() << 101 << 102);
+    GP_CHECK(client.Requests.size() == 1);
+
+    // Connection breaks, nothing that was written from now on arrives
+    client.SendReply(client.Requests.first(), 2, QHash<QString, QVariant>());
+    client.SendProtocolCommand(3);
+    server1.SendProtocolCommand(103);
+    server1.SendProtocolCommand(104);
+    client.Outbox.clear();
+    server1.Outbox.clear();
+
+    // Client reconnects to new instance of server, packets sent before it's resumed wait in replay buffer
+    TestGP server2;
+    server2.EnableResume(true);
+    ResumeHandler handler(&server2, &server1);
+    client.Connected();
+    client.SendProtocolCommand(4);
+    GP_CHECK(client.Outbox.size() == 1);
+    deliver(&client, &server2);
+    GP_CHECK(handler.Accepted);
+    GP_CHECK(server1.GetPendingRequestCount() == 0);
+    GP_CHECK(server2.GetPendingRequestCount() == 1);
+    deliver(&server2, &client);
+    deliver(&client, &server2);
+    GP_CHECK(commands(client) == QList<int>() << 101 << 102 << 103 << 104);
+    // Reply to request sent over previous connection completes it on the new one
+    GP_CHECK(commands(server2) == QList<int>() << 2 << 3 << 4);
+    GP_CHECK(replies == 1);
+    GP_CHECK(reply_ok);
+    GP_CHECK(server2.GetPendingRequestCount() == 0);
+
+    // Frame from before the outage is a duplicate now
+    client.Feed(old_frame);
+    GP_CHECK(client.Received.size() == 4);
+    server2.SendProtocolCommand(105);
+    deliver(&server2, &client);
+    GP_CHECK(commands(client).last() == 105);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    testDeltaNested();
+    testDeltaTypeChange();
+    testDeltaRemovedKeys();
+    testStateSync();
+    testSequenceDuplicates();
+    testResume();
+    if (failures)
+    {
+        QTextStream(stderr) << failures << " checks failed\n";
+        return 1;
+    }
+    QTextStream(stdout) << "All checks passed\n";
+    return 0;
+}
+
+#include "gptest.moc"
@@ -0,0 +1,11 @@
+QT       += network
+
+QT       -= gui
+
+TARGET = gptest
+CONFIG += console
+TEMPLATE = app
+
+SOURCES += gptest.cpp
+
+LIBS += -L$$OUT_PWD/.. -lgp
@@ -18,20 +18,27 @@ using namespace libgp;
 Thread::Thread(GP *gp)
 {
     this->owner = gp;
+    this->stopping = false;
+}
+
+void Thread::Stop()
+{
+    this->stopping = true;
 }
 
 void Thread::run()
 {
-    while (this->isRunning())
+    while (!this->stopping)
     {
-        QByteArray incoming = this->owner->mtPop();
+        gp_byte_t compression_level = 0;
+        QByteArray incoming = this->owner->mtPop(&compression_level);
         if (incoming.isEmpty())
         {
             Thread::msleep(100);
             continue;
         }
         // These 2 calls are probably CPU intensive
-        QHash<QString, QVariant> packet = this->owner->packetFromRawBytes(incoming, this->owner->compression);
+        QHash<QString, QVariant> packet = this->owner->packetFromRawBytes(incoming, compression_level);
         this->owner->processPacket(packet);
     }
 }
@@ -14,6 +14,7 @@
 #define THREAD_H
 
 #include <QThread>
+#include <atomic>
 
 namespace libgp
 {
@@ -24,9 +25,12 @@ namespace libgp
         public:
             Thread(GP *gp);
             ~Thread() override=default;
+            //! Asks the thread to finish, call wait() after this to make sure it's done
+            void Stop();
 
         private:
             GP *owner;
+            std::atomic<bool> stopping;
             void run() override;
     };
 }